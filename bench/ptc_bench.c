@@ -0,0 +1,375 @@
+//------------------------------------------------------------------------------
+/**
+ * @file ptc_bench.c
+ * @author charles-park (charles.park@hardkernel.com)
+ * @brief lib_uart / protocol micro benchmark (make bench)
+ * @version 0.1
+ * @date 2022-10-20
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+//------------------------------------------------------------------------------
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+
+#include "../lib_uart/lib_uart.h"
+#include "../protocol.h"
+
+//------------------------------------------------------------------------------
+//
+// usage : bench/ptc_bench [loop count scale, default 1]
+//
+// queue     : queue_put/queue_get (1 byte), queue_put_n/queue_get_n (frame)
+// parse     : rx_q -> ptc_feed -> check/catch -> unpack (protocol_msg_recv)
+// encode    : protocol_msg_send (ascii, v2) to the tx queue
+// loopback  : frame round trip over a pty pair through the io reactor
+//
+// the protocol layer logs every frame to stdout, that cost is part of the
+// hot path and is measured (stdout is redirected to /dev/null while timing).
+//
+//------------------------------------------------------------------------------
+#define BENCH_QUEUE_LOOP    2000000
+#define BENCH_FRAME_LOOP    100000
+#define BENCH_RTT_LOOP      2000
+#define BENCH_BATCH         16      /* frames queued per feed */
+
+//------------------------------------------------------------------------------
+static  unsigned long long  bench_ns (void);
+static  void    bench_report    (const char *name, unsigned long long ns, __u32 ops, __u32 bytes);
+static  void    bench_quiet     (bool quiet);
+static  int     bench_recv_frame(__u8 *frame, char resp, int uid, const char *data);
+static  int     bench_v2_frame  (__u8 *frame, __u8 seq, char resp, int uid, const char *data);
+static  void    bench_handler   (void *arg, protocol_msg_t *msg);
+static  ptc_grp_t *bench_grp    (void);
+static  void    bench_grp_free  (ptc_grp_t *ptc_grp);
+static  void    bench_queue     (int scale);
+static  void    bench_parse     (int scale);
+static  void    bench_encode    (int scale);
+static  void    *bench_echo_func(void *arg);
+static  void    bench_loopback  (int scale);
+int     main                    (int argc, char **argv);
+
+//------------------------------------------------------------------------------
+static int StdoutFd = -1, NullFd = -1;
+
+//------------------------------------------------------------------------------
+static unsigned long long bench_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return  (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+static void bench_report (const char *name, unsigned long long ns, __u32 ops, __u32 bytes)
+{
+    printf ("%-28s : %10.1f ns/op, %12.0f ops/s", name,
+            (double)ns / ops, (double)ops * 1000000000.0 / ns);
+    if (bytes)
+        printf (", %6.2f ns/byte", (double)ns / bytes);
+    printf ("\n");
+}
+
+//------------------------------------------------------------------------------
+static void bench_quiet (bool quiet)
+{
+    fflush (stdout);
+    if (StdoutFd < 0) {
+        StdoutFd = dup (STDOUT_FILENO);
+        NullFd   = open ("/dev/null", O_WRONLY);
+    }
+    dup2 (quiet ? NullFd : StdoutFd, STDOUT_FILENO);
+}
+
+//------------------------------------------------------------------------------
+// client response frames (ascii : recv protocol + LF/CR, v2 : client payload)
+//------------------------------------------------------------------------------
+static int bench_recv_frame (__u8 *frame, char resp, int uid, const char *data)
+{
+    char uid_str[8];
+
+    memset (frame, ' ', RECV_PROTOCOL_SIZE);
+    frame[RECV_OFS_head]    = '@';
+    frame[RECV_OFS_resp]    = resp;
+    snprintf (uid_str, sizeof(uid_str), "%03d", uid % 1000);
+    memcpy (&frame[RECV_OFS_uid], uid_str, RECV_SIZE_uid);
+    frame[RECV_OFS_status]  = '1';
+    memcpy (&frame[RECV_OFS_data +1], data, strlen(data));
+    frame[RECV_OFS_tail]    = '#';
+    frame[RECV_PROTOCOL_SIZE    ] = '\n';
+    frame[RECV_PROTOCOL_SIZE + 1] = '\r';
+    return  RECV_PROTOCOL_SIZE + 2;
+}
+
+//------------------------------------------------------------------------------
+static int bench_v2_frame (__u8 *frame, __u8 seq, char resp, int uid, const char *data)
+{
+    int len = 3 + strlen(data);
+    __u16 crc;
+
+    frame[0] = PROTOCOL_V2_HEAD;
+    frame[1] = len;
+    frame[2] = seq;
+    frame[3] = resp;
+    frame[PROTOCOL_V2_HDR_SIZE    ] = uid & 0xFF;
+    frame[PROTOCOL_V2_HDR_SIZE + 1] = (uid >> 8) & 0xFF;
+    frame[PROTOCOL_V2_HDR_SIZE + 2] = 1;
+    memcpy (&frame[PROTOCOL_V2_HDR_SIZE + 3], data, strlen(data));
+
+    crc = protocol_crc16 (&frame[1], PROTOCOL_V2_HDR_SIZE -1 + len);
+    frame[PROTOCOL_V2_HDR_SIZE + len    ] = crc >> 8;
+    frame[PROTOCOL_V2_HDR_SIZE + len + 1] = crc & 0xFF;
+    return  PROTOCOL_V2_HDR_SIZE + len + PROTOCOL_V2_CRC_SIZE;
+}
+
+//------------------------------------------------------------------------------
+static void bench_handler (void *arg, protocol_msg_t *msg)
+{
+    (*(__u32 *)arg)++;
+    (void)msg;
+}
+
+//------------------------------------------------------------------------------
+// protocol group without a transport (queues only, as the server installs it)
+//------------------------------------------------------------------------------
+static ptc_grp_t *bench_grp (void)
+{
+    ptc_grp_t *ptc_grp = calloc (1, sizeof(ptc_grp_t));
+
+    if (ptc_grp == NULL)
+        return  NULL;
+
+    ptc_grp->fd = -1;
+    ptc_grp->tx_q.evt_fd = -1;
+    if (!queue_init (&ptc_grp->tx_q, DEFAULT_QUEUE_SIZE) ||
+        !queue_init (&ptc_grp->rx_q, DEFAULT_QUEUE_SIZE) ||
+        !ptc_grp_init (ptc_grp, 2) ||
+        !ptc_func_init (ptc_grp, 0, sizeof(recv_protocol_u), '@',
+                        protocol_check, protocol_catch) ||
+        !protocol_v2_install (ptc_grp, 1)) {
+        err ("bench protocol group init error!\n");
+        exit (1);
+    }
+    return  ptc_grp;
+}
+
+//------------------------------------------------------------------------------
+static void bench_grp_free (ptc_grp_t *ptc_grp)
+{
+    ptc_grp_close (ptc_grp);
+}
+
+//------------------------------------------------------------------------------
+static void bench_queue (int scale)
+{
+    queue_t q;
+    __u8 d = 0x55, frame[PROTOCOL_SEND_FRAME_SIZE];
+    __u32 i, loop = BENCH_QUEUE_LOOP * scale;
+    unsigned long long t;
+
+    memset (&q, 0x00, sizeof(q));
+    q.evt_fd = -1;
+    queue_init (&q, DEFAULT_QUEUE_SIZE);
+    memset (frame, 0x55, sizeof(frame));
+
+    t = bench_ns ();
+    for (i = 0; i < loop; i++) {
+        queue_put (&q, &d);
+        queue_get (&q, &d);
+    }
+    bench_report ("queue_put + queue_get", bench_ns () - t, loop, loop);
+
+    loop /= 8;
+    t = bench_ns ();
+    for (i = 0; i < loop; i++) {
+        queue_put_n (&q, frame, sizeof(frame));
+        queue_get_n (&q, frame, sizeof(frame));
+    }
+    bench_report ("queue_put_n + queue_get_n", bench_ns () - t, loop, loop * sizeof(frame));
+    queue_free (&q);
+}
+
+//------------------------------------------------------------------------------
+static void bench_parse (int scale)
+{
+    ptc_grp_t *ptc_grp = bench_grp ();
+    __u8 stream[BENCH_BATCH * PROTOCOL_V2_FRAME_MAX];
+    __u32 i, j, len, cnt = 0, loop = BENCH_FRAME_LOOP * scale / BENCH_BATCH;
+    __u8 seq = 0;
+    unsigned long long t;
+
+    /* ascii frames */
+    for (i = 0, len = 0; i < BENCH_BATCH; i++)
+        len += bench_recv_frame (&stream[len], 'O', i, "1234");
+
+    bench_quiet (true);
+    t = bench_ns ();
+    for (i = 0; i < loop; i++) {
+        queue_put_n (&ptc_grp->rx_q, stream, len);
+        protocol_msg_recv (ptc_grp, bench_handler, &cnt);
+    }
+    t = bench_ns () - t;
+    bench_quiet (false);
+    bench_report ("parse ascii (feed+chk+catch)", t, cnt, loop * len);
+
+    /* binary v2 frames, seq continues across the batches */
+    protocol_v2_enable (ptc_grp, true);
+    cnt = 0;
+    bench_quiet (true);
+    t = bench_ns ();
+    for (i = 0; i < loop; i++) {
+        for (j = 0, len = 0; j < BENCH_BATCH; j++)
+            len += bench_v2_frame (&stream[len], seq++, 'O', j, "1234");
+        queue_put_n (&ptc_grp->rx_q, stream, len);
+        protocol_msg_recv (ptc_grp, bench_handler, &cnt);
+    }
+    t = bench_ns () - t;
+    bench_quiet (false);
+    bench_report ("parse v2 (+crc, +frame build)", t, cnt, loop * len);
+
+    bench_grp_free (ptc_grp);
+}
+
+//------------------------------------------------------------------------------
+static void bench_encode (int scale)
+{
+    ptc_grp_t *ptc_grp = bench_grp ();
+    __u8 drain[PROTOCOL_V2_FRAME_MAX];
+    __u32 i, loop = BENCH_FRAME_LOOP * scale;
+    unsigned long long t;
+
+    bench_quiet (true);
+    t = bench_ns ();
+    for (i = 0; i < loop; i++) {
+        protocol_msg_send (ptc_grp, 'C', i % 1000, "ETHERNET", "IP");
+        queue_get_n (&ptc_grp->tx_q, drain, sizeof(drain));
+    }
+    t = bench_ns () - t;
+    bench_quiet (false);
+    bench_report ("encode ascii (msg_send)", t, loop, 0);
+
+    protocol_v2_enable (ptc_grp, true);
+    bench_quiet (true);
+    t = bench_ns ();
+    for (i = 0; i < loop; i++) {
+        protocol_msg_send (ptc_grp, 'C', i % 1000, "ETHERNET", "IP");
+        queue_get_n (&ptc_grp->tx_q, drain, sizeof(drain));
+    }
+    t = bench_ns () - t;
+    bench_quiet (false);
+    bench_report ("encode v2 (msg_send)", t, loop, 0);
+
+    bench_grp_free (ptc_grp);
+}
+
+//------------------------------------------------------------------------------
+// client side of the pty pair : answers every 'C' frame with an 'O' frame
+//------------------------------------------------------------------------------
+static void *bench_echo_func (void *arg)
+{
+    int fd = *(int *)arg, len = 0, ret;
+    __u8 rx[256], tx[PROTOCOL_SEND_FRAME_SIZE];
+    __u8 *head;
+    char uid_str[4];
+
+    while ((ret = read (fd, &rx[len], sizeof(rx) - len)) > 0) {
+        len += ret;
+        while ((head = memchr (rx, '@', len)) != NULL) {
+            int pos = head - rx;
+
+            if ((len - pos) < SEND_PROTOCOL_SIZE)
+                break;
+            memcpy (uid_str, &head[SEND_OFS_uid], SEND_SIZE_uid);
+            uid_str[SEND_SIZE_uid] = 0;
+            if (write (fd, tx, bench_recv_frame (tx, 'O', atoi(uid_str), "ECHO")) < 0)
+                return  NULL;
+            pos += SEND_PROTOCOL_SIZE;
+            memmove (rx, &rx[pos], len - pos);
+            len -= pos;
+        }
+        if (len == sizeof(rx))
+            len = 0;
+    }
+    return  NULL;
+}
+
+//------------------------------------------------------------------------------
+static void bench_loopback (int scale)
+{
+    ptc_grp_t *ptc_grp;
+    pthread_t echo;
+    struct termios tty;
+    const char *slave;
+    __u32 i, cnt, loop = BENCH_RTT_LOOP * scale;
+    unsigned long long t, rtt, rtt_min = ~0ULL, rtt_max = 0;
+    int fd;
+
+    if ((ptc_grp = ptc_open ("pty:", 0)) == NULL)
+        return;
+    if (!ptc_grp_init (ptc_grp, 1) ||
+        !ptc_func_init (ptc_grp, 0, sizeof(recv_protocol_u), '@',
+                        protocol_check, protocol_catch))
+        return;
+
+    slave = ptsname (ptc_grp->fd);
+    if ((slave == NULL) || ((fd = open (slave, O_RDWR | O_NOCTTY)) < 0)) {
+        err ("pty slave open error!\n");
+        uart_close (ptc_grp);
+        return;
+    }
+    if (!tcgetattr (fd, &tty)) {
+        cfmakeraw (&tty);
+        tcsetattr (fd, TCSANOW, &tty);
+    }
+    pthread_create (&echo, NULL, bench_echo_func, &fd);
+
+    bench_quiet (true);
+    t = bench_ns ();
+    for (i = 0; i < loop; i++) {
+        unsigned long long s = bench_ns ();
+
+        cnt = 0;
+        protocol_msg_send (ptc_grp, 'C', i % 1000, "BENCH", "ECHO");
+        while (!protocol_msg_recv (ptc_grp, bench_handler, &cnt))
+            sched_yield ();
+
+        rtt = bench_ns () - s;
+        if (rtt < rtt_min)  rtt_min = rtt;
+        if (rtt > rtt_max)  rtt_max = rtt;
+    }
+    t = bench_ns () - t;
+    bench_quiet (false);
+    bench_report ("loopback pty round trip", t, loop, 0);
+    printf ("%-28s : min %llu ns, max %llu ns\n", "",
+            (unsigned long long)rtt_min, (unsigned long long)rtt_max);
+
+    /* master closed first : the echo thread read returns an error */
+    uart_close (ptc_grp);
+    pthread_join (echo, NULL);
+    close (fd);
+}
+
+//------------------------------------------------------------------------------
+int main (int argc, char **argv)
+{
+    int scale = (argc > 1) ? atoi (argv[1]) : 1;
+
+    if (scale < 1)
+        scale = 1;
+
+    printf ("lib_uart / protocol micro benchmark (scale %d)\n", scale);
+    bench_queue     (scale);
+    bench_parse     (scale);
+    bench_encode    (scale);
+    bench_loopback  (scale);
+    return  0;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -59,7 +59,8 @@ int 	get_mac_addr 		(char *mac_str);
 void 	get_netinfo 		(char *mac_str, char *ip_str, int *plink_speed);
 bool 	is_net_alive		(void);
 
-bool 	run_interval_check 	(struct timeval *t, double interval_ms);
+unsigned long long	monotonic_us	(void);
+unsigned long long	monotonic_ms	(void);
 long 	uptime 				(void);
 void 	uptime_str			(char *uptime_str);
 
@@ -70,7 +71,26 @@ int		fread_int       	(char *filename);
 int 	fread_line          (char *filename, char *line, int l_size);
 int		fwrite_bool			(char *filename, char status);
 int 	fwrite_str 			(char *filename, char *wstr);
-int		find_appcfg_data	(char *fkey, char *fdata);
+int		find_appcfg_data	(char *fkey, char *fdata, int max_lines);
+int		timer_fd_open		(int interval_ms, bool periodic);
+bool	timer_fd_set		(int fd, int interval_ms, bool periodic);
+bool	timer_fd_expired	(int fd);
+bool	epoll_fd_add		(int epfd, int fd);
+void	event_fd_clear		(int fd);
+static void tw_insert		(timer_wheel_t *tw, tw_timer_t *t);
+static void tw_cascade		(timer_wheel_t *tw, int level);
+void	tw_init				(timer_wheel_t *tw);
+void	tw_timer_init		(tw_timer_t *t, void (*func)(void *arg), void *arg);
+void	tw_timer_start		(timer_wheel_t *tw, tw_timer_t *t, int delay_ms, int period_ms);
+void	tw_timer_cancel		(tw_timer_t *t);
+bool	tw_timer_active		(tw_timer_t *t);
+void	tw_run				(timer_wheel_t *tw);
+int		tw_next_ms			(timer_wheel_t *tw);
+void	tw_fd_arm			(timer_wheel_t *tw, int fd);
+bool	msg_queue_init		(msg_queue_t *q, int size, int item_size);
+void	msg_queue_close		(msg_queue_t *q);
+void	msg_queue_put		(msg_queue_t *q, const void *item);
+bool	msg_queue_get		(msg_queue_t *q, void *item, bool wait);
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
@@ -208,29 +228,20 @@ void get_netinfo (char *mac_str, char *ip_str, int *plink_speed)
 }
 
 //------------------------------------------------------------------------------
-bool run_interval_check (struct timeval *t, double interval_ms)
+// CLOCK_MONOTONIC : not stepped by ntp / date
+//------------------------------------------------------------------------------
+unsigned long long monotonic_us (void)
 {
-	struct timeval base_time;
-	double difftime;
-
-	gettimeofday(&base_time, NULL);
+	struct timespec ts;
 
-	if (interval_ms) {
-		/* 현재 시간이 interval시간보다 크면 양수가 나옴 */
-		difftime = (base_time.tv_sec - t->tv_sec) +
-					((base_time.tv_usec - (t->tv_usec + interval_ms * 1000)) / 1000000);
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-		if (difftime > 0) {
-			t->tv_sec  = base_time.tv_sec;
-			t->tv_usec = base_time.tv_usec;
-			return true;
-		}
-		return false;
-	}
-	/* 현재 시간 저장 */
-	t->tv_sec  = base_time.tv_sec;
-	t->tv_usec = base_time.tv_usec;
-	return true;
+//------------------------------------------------------------------------------
+unsigned long long monotonic_ms (void)
+{
+	return monotonic_us () / 1000;
 }
 
 //------------------------------------------------------------------------------
@@ -383,12 +394,16 @@ int fwrite_str (char *filename, char *wstr)
 #define CONFIG_APP_FILE_1     "/media/boot/app.cfg"
 #define CONFIG_APP_FILE_2     "app.cfg"
 
-int find_appcfg_data (char *fkey, char *fdata)
+//------------------------------------------------------------------------------
+// max_lines 1 : single value, > 1 : one 128 bytes slot per line (multiline key)
+// lines over max_lines are dropped.
+//------------------------------------------------------------------------------
+int find_appcfg_data (char *fkey, char *fdata, int max_lines)
 {
 	FILE *fp;
 	char read_line[128], *ptr, fname[64];
-	bool appcfg = false, multiline = false;
-	int cmd_cnt = 0, pos = 0;;
+	bool appcfg = false, multiline = (max_lines > 1) ? true : false;
+	int cmd_cnt = 0, pos = 0, drop_cnt = 0;
 
 	memset (fname, 0x00, sizeof(fname));
 	if (access(CONFIG_APP_FILE_1, R_OK) == 0)
@@ -399,10 +414,6 @@ int find_appcfg_data (char *fkey, char *fdata)
 	if (access (fname, R_OK) == 0) {
 		if ((fp = fopen (fname, "r")) != NULL) {
 			memset (read_line, 0x00, sizeof(read_line));
-			if (!strncmp ("SERVER_CMD", fkey, sizeof("SERVER_CMD")-1))
-				multiline = true;
-			if (!strncmp ("POWER_PIN", fkey, sizeof("POWER_PIN")-1))
-				multiline = true;
 
 			while (fgets(read_line, sizeof(read_line), fp) != NULL) {
 
@@ -414,6 +425,11 @@ int find_appcfg_data (char *fkey, char *fdata)
 				}
 				if (read_line[0] != '#') {
 					if ((ptr = strstr (read_line, fkey)) != NULL) {
+						if (cmd_cnt >= max_lines) {
+							drop_cnt++;
+							memset (read_line, 0x00, sizeof(read_line));
+							continue;
+						}
 						ptr = strstr (ptr +1, "=");
 						ptr = ptr +1;
 						while ((ptr != NULL) && (*ptr == ' '))	ptr++;
@@ -432,11 +448,330 @@ int find_appcfg_data (char *fkey, char *fdata)
 				memset (read_line, 0x00, sizeof(read_line));
 			}
 			fclose (fp);
+			if (drop_cnt)
+				err ("%s : %d lines over the limit(%d) are dropped\n",
+					fkey, drop_cnt, max_lines);
+			if (cmd_cnt)
+				return 0;
 		}
 	}
 	return -1;
 }
 
 //------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+// CLOCK_MONOTONIC timerfd (non-blocking), interval_ms 0 : disarmed
+//------------------------------------------------------------------------------
+int timer_fd_open (int interval_ms, bool periodic)
+{
+	int fd;
+
+	if ((fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+		return -1;
+
+	if (!timer_fd_set (fd, interval_ms, periodic)) {
+		close (fd);
+		return -1;
+	}
+	return fd;
+}
+
+//------------------------------------------------------------------------------
+bool timer_fd_set (int fd, int interval_ms, bool periodic)
+{
+	struct itimerspec its;
+
+	memset (&its, 0x00, sizeof(its));
+	its.it_value.tv_sec  = interval_ms / 1000;
+	its.it_value.tv_nsec = (interval_ms % 1000) * 1000000;
+	if (periodic)
+		its.it_interval = its.it_value;
+
+	return timerfd_settime (fd, 0, &its, NULL) ? false : true;
+}
+
+//------------------------------------------------------------------------------
+// expiration count read, false : not expired (EAGAIN)
+//------------------------------------------------------------------------------
+bool timer_fd_expired (int fd)
+{
+	unsigned long long cnt;
+
+	return (read (fd, &cnt, sizeof(cnt)) == sizeof(cnt)) ? true : false;
+}
+
+//------------------------------------------------------------------------------
+bool epoll_fd_add (int epfd, int fd)
+{
+	struct epoll_event ev;
+
+	memset (&ev, 0x00, sizeof(ev));
+	ev.events  = EPOLLIN;
+	ev.data.fd = fd;
+	return epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev) ? false : true;
+}
+
+//------------------------------------------------------------------------------
+// eventfd counter reset (non-blocking eventfd)
+//------------------------------------------------------------------------------
+void event_fd_clear (int fd)
+{
+	eventfd_t cnt;
+
+	eventfd_read (fd, &cnt);
+}
+
+//------------------------------------------------------------------------------
+// timer wheel
+//------------------------------------------------------------------------------
+static void tw_insert (timer_wheel_t *tw, tw_timer_t *t)
+{
+	unsigned long long delta, pos;
+	tw_node_t *head;
+	int level;
+
+	delta = (t->expire > tw->now) ? (t->expire - tw->now) : 0;
+
+	/* smallest level whose span holds the delay */
+	for (level = 0; level < TW_LEVELS -1; level++)
+		if (delta < (1ULL << (TW_SLOT_BITS * (level + 1))))
+			break;
+
+	pos = t->expire;
+	/* over the wheel span : top level, re-inserted on the cascade */
+	if (delta >= (1ULL << (TW_SLOT_BITS * TW_LEVELS)))
+		pos = tw->now + (1ULL << (TW_SLOT_BITS * TW_LEVELS)) -1;
+
+	head = &tw->slot[level][(pos >> (TW_SLOT_BITS * level)) & (TW_SLOTS -1)];
+	t->node.next = head;
+	t->node.prev = head->prev;
+	head->prev->next = &t->node;
+	head->prev = &t->node;
+}
+
+//------------------------------------------------------------------------------
+// timers of the current slot of the level move to the lower levels
+//------------------------------------------------------------------------------
+static void tw_cascade (timer_wheel_t *tw, int level)
+{
+	tw_node_t list, *head, *node;
+
+	head = &tw->slot[level][(tw->now >> (TW_SLOT_BITS * level)) & (TW_SLOTS -1)];
+	if (head->next == head)
+		return;
+
+	/* detach the slot list, then re-insert */
+	list.next = head->next;		list.prev = head->prev;
+	list.next->prev = &list;	list.prev->next = &list;
+	head->next = head->prev = head;
+
+	while ((node = list.next) != &list) {
+		list.next = node->next;
+		node->next->prev = &list;
+		tw_insert (tw, (tw_timer_t *)node);
+	}
+}
+
+//------------------------------------------------------------------------------
+void tw_init (timer_wheel_t *tw)
+{
+	int level, i;
+
+	for (level = 0; level < TW_LEVELS; level++)
+		for (i = 0; i < TW_SLOTS; i++)
+			tw->slot[level][i].next = tw->slot[level][i].prev = &tw->slot[level][i];
+
+	tw->now = monotonic_ms ();
+}
+
+//------------------------------------------------------------------------------
+void tw_timer_init (tw_timer_t *t, void (*func)(void *arg), void *arg)
+{
+	memset (t, 0x00, sizeof(tw_timer_t));
+	t->func = func;		t->arg = arg;
+}
+
+//------------------------------------------------------------------------------
+// delay_ms : first expiry, period_ms : periodic interval (0 : one-shot)
+// a started timer is restarted with the new delay.
+//------------------------------------------------------------------------------
+void tw_timer_start (timer_wheel_t *tw, tw_timer_t *t, int delay_ms, int period_ms)
+{
+	tw_timer_cancel (t);
+
+	/* expires on the next tick at least */
+	t->expire = tw->now + ((delay_ms > 0) ? delay_ms : 1);
+	t->period = period_ms;
+	tw_insert (tw, t);
+}
+
+//------------------------------------------------------------------------------
+void tw_timer_cancel (tw_timer_t *t)
+{
+	if (t->node.next == NULL)
+		return;
+
+	t->node.prev->next = t->node.next;
+	t->node.next->prev = t->node.prev;
+	t->node.next = t->node.prev = NULL;
+}
+
+//------------------------------------------------------------------------------
+bool tw_timer_active (tw_timer_t *t)
+{
+	return (t->node.next != NULL) ? true : false;
+}
+
+//------------------------------------------------------------------------------
+// advance the wheel to the monotonic clock, expired timers are called.
+// a periodic timer is re-inserted before its call (the callback may cancel it).
+//------------------------------------------------------------------------------
+void tw_run (timer_wheel_t *tw)
+{
+	unsigned long long target = monotonic_ms ();
+	tw_node_t *head;
+	tw_timer_t *t;
+	int level;
+
+	while (tw->now < target) {
+		tw->now++;
+
+		for (level = 1; level < TW_LEVELS; level++) {
+			if (tw->now & ((1ULL << (TW_SLOT_BITS * level)) -1))
+				break;
+			tw_cascade (tw, level);
+		}
+
+		head = &tw->slot[0][tw->now & (TW_SLOTS -1)];
+		while (head->next != head) {
+			t = (tw_timer_t *)head->next;
+			tw_timer_cancel (t);
+
+			if (t->period) {
+				t->expire += t->period;
+				/* late wakeup : no burst of the missed periods */
+				if (t->expire <= tw->now)
+					t->expire = tw->now + t->period;
+				tw_insert (tw, t);
+			}
+			t->func (t->arg);
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+// ms to the next expiry or cascade (0 : due, -1 : no timer)
+// a cascade before the level 0 expiry may bring a sooner timer down,
+// the nearest cascade of a non-empty level is always a candidate.
+//------------------------------------------------------------------------------
+int tw_next_ms (timer_wheel_t *tw)
+{
+	unsigned long long pos, next = 0;
+	int level, i;
+
+	for (i = 0; i < TW_SLOTS; i++) {
+		tw_node_t *head = &tw->slot[0][(tw->now + i) & (TW_SLOTS -1)];
+		if (head->next != head) {
+			if (!i)
+				return 0;
+			next = i;
+			break;
+		}
+	}
+	for (level = 1; level < TW_LEVELS; level++) {
+		pos = tw->now >> (TW_SLOT_BITS * level);
+		for (i = 1; i <= TW_SLOTS; i++) {
+			tw_node_t *head = &tw->slot[level][(pos + i) & (TW_SLOTS -1)];
+			if (head->next != head) {
+				unsigned long long t = ((pos + i) << (TW_SLOT_BITS * level)) - tw->now;
+				if (!next || (t < next))
+					next = t;
+				break;
+			}
+		}
+	}
+	return next ? (int)next : -1;
+}
+
+//------------------------------------------------------------------------------
+// one-shot timerfd at the next wheel expiry (event loop clock source)
+//------------------------------------------------------------------------------
+void tw_fd_arm (timer_wheel_t *tw, int fd)
+{
+	int next = tw_next_ms (tw);
+
+	/* 0 is disarm for timerfd : due timers run on the next tick */
+	timer_fd_set (fd, (next < 0) ? 0 : (next ? next : 1), false);
+}
+
+//------------------------------------------------------------------------------
+// message queue : size items of item_size bytes
+//------------------------------------------------------------------------------
+bool msg_queue_init (msg_queue_t *q, int size, int item_size)
+{
+	memset (q, 0x00, sizeof(msg_queue_t));
+	if ((q->buf = calloc (size, item_size)) == NULL)
+		return false;
+	if ((q->evt_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+		free (q->buf);
+		q->buf = NULL;
+		return false;
+	}
+
+	q->size = size;		q->item_size = item_size;
+	pthread_mutex_init (&q->lock, NULL);
+	pthread_cond_init  (&q->cond, NULL);
+	return true;
+}
+
+//------------------------------------------------------------------------------
+void msg_queue_close (msg_queue_t *q)
+{
+	if (q->buf == NULL)
+		return;
+	pthread_cond_destroy  (&q->cond);
+	pthread_mutex_destroy (&q->lock);
+	close (q->evt_fd);
+	free (q->buf);
+	q->buf = NULL;
+}
+
+//------------------------------------------------------------------------------
+// queue full : wait for the reader (messages are never dropped)
+//------------------------------------------------------------------------------
+void msg_queue_put (msg_queue_t *q, const void *item)
+{
+	pthread_mutex_lock (&q->lock);
+	while (q->cnt == q->size)
+		pthread_cond_wait (&q->cond, &q->lock);
+
+	memcpy (&q->buf[((q->head + q->cnt) % q->size) * q->item_size], item, q->item_size);
+	q->cnt++;
+	pthread_cond_broadcast (&q->cond);
+	pthread_mutex_unlock (&q->lock);
+	eventfd_write (q->evt_fd, 1);
+}
+
+//------------------------------------------------------------------------------
+// wait == false : return false if the queue is empty
+//------------------------------------------------------------------------------
+bool msg_queue_get (msg_queue_t *q, void *item, bool wait)
+{
+	pthread_mutex_lock (&q->lock);
+	while (!q->cnt) {
+		if (!wait) {
+			pthread_mutex_unlock (&q->lock);
+			return false;
+		}
+		pthread_cond_wait (&q->cond, &q->lock);
+	}
+	memcpy (item, &q->buf[q->head * q->item_size], q->item_size);
+	q->head = (q->head + 1) % q->size;
+	q->cnt--;
+	pthread_cond_broadcast (&q->cond);
+	pthread_mutex_unlock (&q->lock);
+	return true;
+}
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
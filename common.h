@@ -16,12 +16,14 @@
 //------------------------------------------------------------------------------
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <linux/fb.h>
 #include <limits.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,16 +31,63 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <linux/netlink.h>
 #include <linux/sockios.h>
 #include <netinet/ether.h>
 #include <net/if.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/sysinfo.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 
+//------------------------------------------------------------------------------
+/* thread safe fixed size message queue (worker threads -> ui / printer) */
+typedef struct msg_queue__t {
+	pthread_mutex_t	lock;
+	/* put : not full, get : not empty */
+	pthread_cond_t	cond;
+	int		item_size, size;
+	int		head, cnt;
+	char	*buf;
+	/* eventfd written on put (epoll wakeup of the reader) */
+	int		evt_fd;
+}	msg_queue_t;
+
+//------------------------------------------------------------------------------
+// hierarchical timer wheel (CLOCK_MONOTONIC, 1 ms tick)
+// level n slot : TW_SLOTS^n ticks, a timer cascades to the lower level
+// when the wheel reaches its slot. max delay TW_SLOTS^TW_LEVELS ms (4.6 h).
+// a wheel is not thread safe : one wheel per thread (event loop).
+//------------------------------------------------------------------------------
+#define	TW_LEVELS		4
+#define	TW_SLOT_BITS	6
+#define	TW_SLOTS		(1 << TW_SLOT_BITS)
+
+typedef struct tw_node__t {
+	struct tw_node__t	*next, *prev;
+}	tw_node_t;
+
+typedef struct tw_timer__t {
+	/* slot list (next == NULL : not started) */
+	tw_node_t			node;
+	unsigned long long	expire;
+	/* periodic timer interval (ms), 0 : one-shot */
+	int					period;
+	void				(*func)(void *arg);
+	void				*arg;
+}	tw_timer_t;
+
+typedef struct timer_wheel__t {
+	/* current tick (monotonic ms) */
+	unsigned long long	now;
+	tw_node_t			slot[TW_LEVELS][TW_SLOTS];
+}	timer_wheel_t;
+
 //------------------------------------------------------------------------------
 // Function prototype
 //------------------------------------------------------------------------------
@@ -47,7 +96,8 @@ extern  int     get_ip_addr     (const char *eth_name, char *ip, int *link_speed
 extern  int     get_mac_addr    (char *mac_str);
 extern  void    get_netinfo     (char *mac_str, char *ip_str, int *plink_speed);
 
-extern  bool run_interval_check (struct timeval *t, double interval_ms);
+extern  unsigned long long monotonic_us (void);
+extern  unsigned long long monotonic_ms (void);
 extern  long uptime 			(void);
 extern  void uptime_str			(char *uptime_str);
 
@@ -60,7 +110,27 @@ extern  int fread_line          (char *filename, char *line, int l_size);
 
 extern  int fwrite_bool			(char *filename, char status);
 extern  int fwrite_str 			(char *filename, char *wstr);
-extern  int find_appcfg_data    (char *fkey, char *fdata);
+extern  int find_appcfg_data    (char *fkey, char *fdata, int max_lines);
+
+extern	int  timer_fd_open		(int interval_ms, bool periodic);
+extern	bool timer_fd_set		(int fd, int interval_ms, bool periodic);
+extern	bool timer_fd_expired	(int fd);
+extern	bool epoll_fd_add		(int epfd, int fd);
+extern	void event_fd_clear		(int fd);
+
+extern	void tw_init			(timer_wheel_t *tw);
+extern	void tw_timer_init		(tw_timer_t *t, void (*func)(void *arg), void *arg);
+extern	void tw_timer_start		(timer_wheel_t *tw, tw_timer_t *t, int delay_ms, int period_ms);
+extern	void tw_timer_cancel	(tw_timer_t *t);
+extern	bool tw_timer_active	(tw_timer_t *t);
+extern	void tw_run				(timer_wheel_t *tw);
+extern	int  tw_next_ms			(timer_wheel_t *tw);
+extern	void tw_fd_arm			(timer_wheel_t *tw, int fd);
+
+extern	bool msg_queue_init		(msg_queue_t *q, int size, int item_size);
+extern	void msg_queue_close	(msg_queue_t *q);
+extern	void msg_queue_put		(msg_queue_t *q, const void *item);
+extern	bool msg_queue_get		(msg_queue_t *q, void *item, bool wait);
 
 //------------------------------------------------------------------------------
 #endif	// __COMMON_H__
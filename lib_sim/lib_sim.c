@@ -0,0 +1,420 @@
+//------------------------------------------------------------------------------
+/**
+ * @file lib_sim.c
+ * @author charles-park (charles.park@hardkernel.com)
+ * @brief DUT(client) simulator on pseudo terminals (hardware free test run)
+ * @version 0.1
+ * @date 2022-10-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+//------------------------------------------------------------------------------
+#define _GNU_SOURCE     // posix_openpt(), ptsname()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------
+#include "../lib_uart/lib_uart.h"
+#include "../protocol.h"
+#include "lib_sim.h"
+
+//------------------------------------------------------------------------------
+//   Simulated client
+//      'R'eady is sent at boot, 'C'ommand is answered with 'O'kay after the
+//      response latency, 'P'(reboot) restarts the boot.
+//      fault injection (per 1000 responses) :
+//          busy    : 'B'usy instead of the response (server sends it again)
+//          drop    : one byte of the response frame is lost
+//          garbage : random bytes before the response frame
+//          error   : 'E'rror (status 0) instead of the 'O'kay response
+//------------------------------------------------------------------------------
+static  unsigned long long       sim_time_ms     (void);
+static  int         sim_frame       (__u8 *frame, char resp, int uid, int status, const char *data);
+static  void        sim_send        (sim_t *psim, sim_channel_t *pch, char resp, int uid,
+                                    int status, const char *data, bool fault);
+static  sim_adc_t   *sim_adc_find   (sim_channel_t *pch, const char *name, bool add);
+static  void        sim_cmd_catch   (sim_t *psim, sim_channel_t *pch, const __u8 *frame);
+static  void        sim_rx          (sim_t *psim, sim_channel_t *pch);
+static  void        *sim_thread_func(void *arg);
+        sim_t       *sim_init       (int ch_cnt, int latency_ms, int drop_rate,
+                                    int busy_rate, int garbage_rate, int error_rate);
+        bool        sim_start      (sim_t *psim);
+        const char  *sim_dev_name   (sim_t *psim, int ch);
+        void        sim_cmd_add     (sim_t *psim, int ch, int uid, const char *data,
+                                    const char *adc_name, const int *values, int cnt);
+        void        sim_adc_set     (sim_t *psim, int ch, const char *name,
+                                    const int *values, int cnt);
+        bool        sim_adc_read    (sim_t *psim, int ch, const char *name,
+                                    unsigned int *values, unsigned int *cnt);
+        fb_info_t   *sim_fb_init    (int w, int h);
+
+//------------------------------------------------------------------------------
+static unsigned long long sim_time_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return  (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//------------------------------------------------------------------------------
+// client to server frame (recv protocol of the server) + LF/CR
+//------------------------------------------------------------------------------
+static int sim_frame (__u8 *frame, char resp, int uid, int status, const char *data)
+{
+    char uid_str[8];
+    int len = strlen (data);
+
+    memset (frame, ' ', RECV_PROTOCOL_SIZE);
+    frame[RECV_OFS_head]    = '@';
+    frame[RECV_OFS_resp]    = resp;
+    snprintf (uid_str, sizeof(uid_str), "%03d", uid % 1000);
+    memcpy (&frame[RECV_OFS_uid], uid_str, RECV_SIZE_uid);
+    frame[RECV_OFS_status]  = status ? '1' : '0';
+
+    /* data[0] is the separator */
+    if (len > RECV_SIZE_data -1)
+        len = RECV_SIZE_data -1;
+    memcpy (&frame[RECV_OFS_data +1], data, len);
+    frame[RECV_OFS_tail]    = '#';
+
+    frame[RECV_PROTOCOL_SIZE    ] = '\n';
+    frame[RECV_PROTOCOL_SIZE + 1] = '\r';
+    return  RECV_PROTOCOL_SIZE + 2;
+}
+
+//------------------------------------------------------------------------------
+static void sim_send (sim_t *psim, sim_channel_t *pch, char resp, int uid,
+                    int status, const char *data, bool fault)
+{
+    sim_pending_t *pend;
+    int i, cnt;
+
+    if (pch->pending_cnt >= SIM_PENDING_MAX) {
+        err ("sim %s : pending response full\n", pch->slave_name);
+        return;
+    }
+    pend = &pch->pending[pch->pending_cnt++];
+    pend->due_ms = sim_time_ms () + psim->latency_ms;
+    pend->len    = 0;
+
+    if (fault && ((rand () % 1000) < psim->garbage_rate)) {
+        cnt = 1 + rand () % 8;
+        for (i = 0; i < cnt; i++)
+            pend->frame[pend->len++] = ' ' + rand () % 0x5F;
+        psim->garbage_count++;
+    }
+    pend->len += sim_frame (&pend->frame[pend->len], resp, uid, status, data);
+
+    if (fault && ((rand () % 1000) < psim->drop_rate)) {
+        i = rand () % pend->len;
+        memmove (&pend->frame[i], &pend->frame[i +1], pend->len - i -1);
+        pend->len--;
+        psim->drop_count++;
+    }
+}
+
+//------------------------------------------------------------------------------
+static sim_adc_t *sim_adc_find (sim_channel_t *pch, const char *name, bool add)
+{
+    int i;
+
+    for (i = 0; i < pch->adc_cnt; i++) {
+        if (!strncmp (pch->adcs[i].name, name, sizeof(pch->adcs[i].name)))
+            return  &pch->adcs[i];
+    }
+    if (!add || (pch->adc_cnt >= SIM_ADC_MAX))
+        return  NULL;
+
+    memset (&pch->adcs[pch->adc_cnt], 0x00, sizeof(sim_adc_t));
+    strncpy (pch->adcs[pch->adc_cnt].name, name, sizeof(pch->adcs[0].name) -1);
+    return  &pch->adcs[pch->adc_cnt++];
+}
+
+//------------------------------------------------------------------------------
+static void sim_cmd_catch (sim_t *psim, sim_channel_t *pch, const __u8 *frame)
+{
+    char uid_str[SEND_SIZE_uid +1];
+    int uid, i;
+    sim_cmd_t *pcmd = NULL;
+    sim_adc_t *padc;
+
+    memset (uid_str, 0x00, sizeof(uid_str));
+    memcpy (uid_str, &frame[SEND_OFS_uid], SEND_SIZE_uid);
+    uid = atoi (uid_str);
+
+    switch (frame[SEND_OFS_cmd]) {
+        case    'P':
+            /* reboot : pending responses are lost */
+            pch->pending_cnt = 0;
+            pch->boot_ms = sim_time_ms () + SIM_BOOT_DELAY;
+        break;
+        case    'C':
+            psim->cmd_count++;
+            if (pch->boot_ms)
+                break;
+            if ((rand () % 1000) < psim->busy_rate) {
+                psim->busy_count++;
+                sim_send (psim, pch, 'B', uid, 0, "BUSY", false);
+                break;
+            }
+            /* command failed on the client : adc state is not changed */
+            if ((rand () % 1000) < psim->error_rate) {
+                psim->error_count++;
+                sim_send (psim, pch, 'E', uid, 0, "ERROR", true);
+                break;
+            }
+            for (i = 0; i < pch->cmd_cnt; i++) {
+                if (pch->cmds[i].uid == uid) {
+                    pcmd = &pch->cmds[i];
+                    break;
+                }
+            }
+            /* adc state is changed before the response (server reads adc on response) */
+            if ((pcmd != NULL) && pcmd->cnt &&
+                ((padc = sim_adc_find (pch, pcmd->adc_name, true)) != NULL)) {
+                memcpy (padc->values, pcmd->values, sizeof(padc->values));
+                padc->cnt = pcmd->cnt;
+            }
+            sim_send (psim, pch, 'O', uid, 1, (pcmd != NULL) ? pcmd->data : "SIM", true);
+        break;
+        default :
+        break;
+    }
+}
+
+//------------------------------------------------------------------------------
+// server to client frames : '@' .. '#' (send protocol size)
+//------------------------------------------------------------------------------
+static void sim_rx (sim_t *psim, sim_channel_t *pch)
+{
+    int ret, pos = 0;
+
+    ret = read (pch->fd, &pch->rx_buf[pch->rx_len], sizeof(pch->rx_buf) - pch->rx_len);
+    if (ret <= 0)
+        return;
+    pch->rx_len += ret;
+
+    while ((pch->rx_len - pos) >= SEND_PROTOCOL_SIZE) {
+        if ((pch->rx_buf[pos] == '@') &&
+            (pch->rx_buf[pos + SEND_OFS_tail] == '#')) {
+            sim_cmd_catch (psim, pch, &pch->rx_buf[pos]);
+            pos += SEND_PROTOCOL_SIZE;
+        }
+        else
+            pos++;
+    }
+    memmove (pch->rx_buf, &pch->rx_buf[pos], pch->rx_len - pos);
+    pch->rx_len -= pos;
+}
+
+//------------------------------------------------------------------------------
+static void *sim_thread_func (void *arg)
+{
+    sim_t *psim = (sim_t *)arg;
+    struct pollfd fds[SIM_CHANNEL_MAX];
+    sim_channel_t *pch;
+    unsigned long long now, next;
+    int ch, i, done;
+
+    for (ch = 0; ch < psim->ch_cnt; ch++) {
+        fds[ch].fd     = psim->ch[ch].fd;
+        fds[ch].events = POLLIN;
+    }
+    while (true) {
+        now = sim_time_ms ();   next = now + 10;
+
+        pthread_mutex_lock (&psim->lock);
+        for (ch = 0; ch < psim->ch_cnt; ch++) {
+            pch = &psim->ch[ch];
+            if (pch->boot_ms && (now >= pch->boot_ms)) {
+                pch->boot_ms = 0;
+                sim_send (psim, pch, 'R', 0, 1, "READY", false);
+            }
+            /* responses are queued in time order (same latency) */
+            for (done = 0; done < pch->pending_cnt; done++) {
+                if (pch->pending[done].due_ms > now) {
+                    if (pch->pending[done].due_ms < next)
+                        next = pch->pending[done].due_ms;
+                    break;
+                }
+                if (write (pch->fd, pch->pending[done].frame, pch->pending[done].len) < 0)
+                    err ("sim %s : write error %s\n", pch->slave_name, strerror(errno));
+            }
+            for (i = done; i < pch->pending_cnt; i++)
+                pch->pending[i - done] = pch->pending[i];
+            pch->pending_cnt -= done;
+        }
+        pthread_mutex_unlock (&psim->lock);
+
+        if (poll (fds, psim->ch_cnt, (int)(next - now)) <= 0)
+            continue;
+
+        pthread_mutex_lock (&psim->lock);
+        for (ch = 0; ch < psim->ch_cnt; ch++) {
+            if (fds[ch].revents & POLLIN)
+                sim_rx (psim, &psim->ch[ch]);
+        }
+        pthread_mutex_unlock (&psim->lock);
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+// pty pairs of the channels, the server opens sim_dev_name() as its uart.
+//------------------------------------------------------------------------------
+sim_t *sim_init (int ch_cnt, int latency_ms, int drop_rate, int busy_rate, int garbage_rate,
+                int error_rate)
+{
+    sim_t *psim;
+    struct termios tty;
+    char *slave;
+    int ch, fd;
+
+    if ((ch_cnt > SIM_CHANNEL_MAX) ||
+        ((psim = (sim_t *)malloc (sizeof(sim_t))) == NULL))
+        return NULL;
+
+    memset (psim, 0x00, sizeof(sim_t));
+    psim->ch_cnt        = ch_cnt;
+    psim->latency_ms    = latency_ms;
+    psim->drop_rate     = drop_rate;
+    psim->busy_rate     = busy_rate;
+    psim->garbage_rate  = garbage_rate;
+    psim->error_rate    = error_rate;
+    pthread_mutex_init (&psim->lock, NULL);
+
+    for (ch = 0; ch < ch_cnt; ch++) {
+        if (((fd = posix_openpt (O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) ||
+            grantpt (fd) || unlockpt (fd) || ((slave = ptsname (fd)) == NULL)) {
+            err ("sim channel %d pty open error!\n", ch);
+            return NULL;
+        }
+        if (!tcgetattr (fd, &tty)) {
+            cfmakeraw (&tty);
+            tcsetattr (fd, TCSANOW, &tty);
+        }
+        psim->ch[ch].fd = fd;
+        strncpy (psim->ch[ch].slave_name, slave, sizeof(psim->ch[ch].slave_name) -1);
+
+        /* slave is kept open : no hangup on the master while the server reopens it */
+        if (open (slave, O_RDWR | O_NOCTTY) < 0)
+            err ("sim channel %d slave open error!\n", ch);
+
+        psim->ch[ch].boot_ms = sim_time_ms () + SIM_BOOT_DELAY;
+        info ("sim channel %d : %s\n", ch, slave);
+    }
+    return  psim;
+}
+
+//------------------------------------------------------------------------------
+bool sim_start (sim_t *psim)
+{
+    int ch;
+
+    for (ch = 0; ch < psim->ch_cnt; ch++)
+        psim->ch[ch].boot_ms = sim_time_ms () + SIM_BOOT_DELAY;
+
+    if (pthread_create (&psim->thread, NULL, sim_thread_func, psim)) {
+        err ("sim thread create error!\n");
+        return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+const char *sim_dev_name (sim_t *psim, int ch)
+{
+    return  psim->ch[ch].slave_name;
+}
+
+//------------------------------------------------------------------------------
+// response of a command uid and the adc values after the command
+//------------------------------------------------------------------------------
+void sim_cmd_add (sim_t *psim, int ch, int uid, const char *data,
+                const char *adc_name, const int *values, int cnt)
+{
+    sim_channel_t *pch = &psim->ch[ch];
+    sim_cmd_t *pcmd;
+
+    if (pch->cmd_cnt >= SIM_CMD_MAX)
+        return;
+
+    pcmd = &pch->cmds[pch->cmd_cnt++];
+    memset (pcmd, 0x00, sizeof(sim_cmd_t));
+    pcmd->uid = uid;
+    strncpy (pcmd->data, data, sizeof(pcmd->data) -1);
+    if ((adc_name != NULL) && (cnt > 0)) {
+        strncpy (pcmd->adc_name, adc_name, sizeof(pcmd->adc_name) -1);
+        pcmd->cnt = (cnt > SIM_ADC_PINS) ? SIM_ADC_PINS : cnt;
+        memcpy (pcmd->values, values, pcmd->cnt * sizeof(int));
+    }
+}
+
+//------------------------------------------------------------------------------
+void sim_adc_set (sim_t *psim, int ch, const char *name, const int *values, int cnt)
+{
+    sim_adc_t *padc;
+
+    pthread_mutex_lock (&psim->lock);
+    if ((padc = sim_adc_find (&psim->ch[ch], name, true)) != NULL) {
+        padc->cnt = (cnt > SIM_ADC_PINS) ? SIM_ADC_PINS : cnt;
+        memcpy (padc->values, values, padc->cnt * sizeof(int));
+    }
+    pthread_mutex_unlock (&psim->lock);
+}
+
+//------------------------------------------------------------------------------
+// adc_read_pin() of the simulated adc board
+//------------------------------------------------------------------------------
+bool sim_adc_read (sim_t *psim, int ch, const char *name,
+                unsigned int *values, unsigned int *cnt)
+{
+    sim_adc_t *padc;
+    int i;
+
+    pthread_mutex_lock (&psim->lock);
+    if ((padc = sim_adc_find (&psim->ch[ch], name, false)) != NULL) {
+        for (i = 0; i < padc->cnt; i++)
+            values[i] = padc->values[i];
+        *cnt = padc->cnt;
+    }
+    else {
+        values[0] = 0;  *cnt = 1;
+    }
+    pthread_mutex_unlock (&psim->lock);
+    return  (padc != NULL) ? true : false;
+}
+
+//------------------------------------------------------------------------------
+// memory framebuffer (no display device)
+//------------------------------------------------------------------------------
+fb_info_t *sim_fb_init (int w, int h)
+{
+    fb_info_t *fb = (fb_info_t *)malloc(sizeof(fb_info_t));
+
+    if (fb == NULL)
+        return NULL;
+
+    memset (fb, 0x00, sizeof(fb_info_t));
+    fb->w       = w;
+    fb->h       = h;
+    fb->bpp     = 32;
+    fb->stride  = w * 4;
+    if ((fb->base = fb->data = (char *)calloc (1, fb->stride * h)) == NULL) {
+        free (fb);
+        return NULL;
+    }
+    return  fb;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
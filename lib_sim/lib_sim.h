@@ -0,0 +1,104 @@
+//------------------------------------------------------------------------------
+/**
+ * @file lib_sim.h
+ * @author charles-park (charles.park@hardkernel.com)
+ * @brief DUT(client) simulator on pseudo terminals (hardware free test run)
+ * @version 0.1
+ * @date 2022-10-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+//------------------------------------------------------------------------------
+#ifndef __LIB_SIM_H__
+#define __LIB_SIM_H__
+
+//------------------------------------------------------------------------------
+#include <pthread.h>
+#include "../typedefs.h"
+#include "../lib_fb/lib_fb.h"
+
+//------------------------------------------------------------------------------
+#define SIM_CHANNEL_MAX     8
+#define SIM_CMD_MAX         256
+#define SIM_ADC_MAX         64
+#define SIM_ADC_PINS        40
+#define SIM_PENDING_MAX     32
+/* client boot time after power on / 'P'(reboot) */
+#define SIM_BOOT_DELAY      100     /* ms */
+
+//------------------------------------------------------------------------------
+/* response of a command and the adc state it leaves */
+typedef struct sim_cmd__t {
+    int     uid;
+    char    data[16];
+    char    adc_name[16];
+    int     values[SIM_ADC_PINS];
+    int     cnt;
+}   sim_cmd_t;
+
+/* adc pin (or header) value seen by the server */
+typedef struct sim_adc__t {
+    char    name[16];
+    int     values[SIM_ADC_PINS];
+    int     cnt;
+}   sim_adc_t;
+
+/* response waiting for its latency */
+typedef struct sim_pending__t {
+    unsigned long long   due_ms;
+    int     len;
+    __u8    frame[48];
+}   sim_pending_t;
+
+typedef struct sim_channel__t {
+    /* client side of the pty pair, server opens slave_name */
+    int         fd;
+    char        slave_name[64];
+
+    /* 'R'eady is sent at boot_ms (0 : booted) */
+    unsigned long long       boot_ms;
+
+    __u8        rx_buf[256];
+    int         rx_len;
+
+    sim_cmd_t   cmds[SIM_CMD_MAX];
+    int         cmd_cnt;
+    sim_adc_t   adcs[SIM_ADC_MAX];
+    int         adc_cnt;
+
+    sim_pending_t   pending[SIM_PENDING_MAX];
+    int             pending_cnt;
+}   sim_channel_t;
+
+typedef struct sim__t {
+    int             ch_cnt;
+    sim_channel_t   ch[SIM_CHANNEL_MAX];
+
+    /* response latency, fault rate (per 1000 responses) */
+    int             latency_ms;
+    int             drop_rate, busy_rate, garbage_rate, error_rate;
+
+    /* counters */
+    int             cmd_count, drop_count, busy_count, garbage_count, error_count;
+
+    pthread_t       thread;
+    pthread_mutex_t lock;
+}   sim_t;
+
+//------------------------------------------------------------------------------
+extern  sim_t       *sim_init       (int ch_cnt, int latency_ms, int drop_rate,
+                                    int busy_rate, int garbage_rate, int error_rate);
+extern  bool        sim_start      (sim_t *psim);
+extern  const char  *sim_dev_name   (sim_t *psim, int ch);
+extern  void        sim_cmd_add     (sim_t *psim, int ch, int uid, const char *data,
+                                    const char *adc_name, const int *values, int cnt);
+extern  void        sim_adc_set     (sim_t *psim, int ch, const char *name,
+                                    const int *values, int cnt);
+extern  bool        sim_adc_read    (sim_t *psim, int ch, const char *name,
+                                    unsigned int *values, unsigned int *cnt);
+extern  fb_info_t   *sim_fb_init    (int w, int h);
+
+//------------------------------------------------------------------------------
+#endif  // __LIB_SIM_H__
+//------------------------------------------------------------------------------
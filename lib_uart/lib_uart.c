@@ -13,6 +13,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <libgen.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>     // getsockopt() SO_ERROR
+#include <linux/serial.h>   // struct serial_struct, serial_icounter_struct
 
 //------------------------------------------------------------------------------
 // Linux headers
@@ -20,68 +24,483 @@
 #include "lib_uart.h"
 
 //------------------------------------------------------------------------------
+bool        queue_init      (queue_t *q, __u32 size);
+void        queue_free      (queue_t *q);
+__u32       queue_count     (queue_t *q);
+__u32       queue_space     (queue_t *q);
 bool        queue_put       (queue_t *q, __u8 *d);
+__u32       queue_put_n     (queue_t *q, const __u8 *d, __u32 n);
 bool        queue_get       (queue_t *q, __u8 *d);
-void        *rx_thread_func (void *arg);
-void        *tx_thread_func (void *arg);
+__u32       queue_get_n     (queue_t *q, __u8 *d, __u32 n);
+__u32       queue_peek      (queue_t *q, __u8 *d, __u32 n);
+int         queue_wr_iov    (queue_t *q, struct iovec *iov);
+void        queue_wr_commit (queue_t *q, __u32 n);
+int         queue_rd_iov    (queue_t *q, struct iovec *iov);
+void        queue_rd_commit (queue_t *q, __u32 n);
+static int  queue_fill_fd   (queue_t *q, ptc_grp_t *ptc_grp);
+static int  queue_drain_fd  (queue_t *q, ptc_grp_t *ptc_grp);
+static void reactor_dispatch(io_event_t *ev, __u32 events);
+static void *reactor_thread_func (void *arg);
+bool        uart_reactor_add(ptc_grp_t *ptc_grp);
+void        uart_reactor_del(ptc_grp_t *ptc_grp);
 void        ptc_set_status  (ptc_grp_t *ptc_grp, __u8 ptc_num, bool status);
-void        ptc_q           (ptc_grp_t *ptc_grp, __u8 ptc_num, __u8 idata);
-void        ptc_event       (ptc_grp_t *ptc_grp, __u8 idata);
-bool        ptc_func_init   (ptc_grp_t *ptc_grp, __u8 ptc_num, __u8 ptc_size, 
+__u32       ptc_feed        (ptc_grp_t *ptc_grp);
+static bool ptc_gap_filler  (const __u8 *d, __u32 n);
+bool        ptc_frame_get   (ptc_grp_t *ptc_grp, __u8 ptc_num, ptc_frame_t *frame);
+bool        ptc_func_init   (ptc_grp_t *ptc_grp, __u8 ptc_num, __u32 ptc_size, __u8 head,
         int (*chk_func)(ptc_var_t *var), int (*cat_func)(ptc_var_t *var));
 bool        ptc_grp_init    (ptc_grp_t *ptc_grp, __u8 ptc_count);
 void        ptc_grp_close   (ptc_grp_t *ptc_grp);
+bool        ptc_link_lost   (ptc_grp_t *ptc_grp);
+bool        ptc_stats_get   (ptc_grp_t *ptc_grp, ptc_stats_t *stats);
+void        ptc_stats_dump  (ptc_grp_t *ptc_grp, const char *name);
+ptc_grp_t   *ptc_grp_open   (const transport_t *tp, const char *addr, int param);
+ptc_grp_t   *ptc_open       (const char *addr, int param);
 ptc_grp_t   *uart_init      (const char *dev_name, speed_t baud);
 void        uart_close      (ptc_grp_t *ptc_grp);
+speed_t     uart_baud_speed (int baud_rate);
+bool        uart_set_baud   (ptc_grp_t *ptc_grp, speed_t baud);
+int         uart_latency_timer (const char *dev_name, int latency_ms);
+bool        uart_low_latency(ptc_grp_t *ptc_grp);
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-bool queue_put (queue_t *q, __u8 *d)
+//   SPSC queue
+//------------------------------------------------------------------------------
+bool queue_init (queue_t *q, __u32 size)
 {
-    q->buf[q->ep++] = *d;
-    if (q->ep >= q->size)   q->ep = 0;
-    // queue overflow
-    if (q->ep == q->sp) {
-        q->sp++;
-        return false;
+    __u32 q_size = 1;
+
+    /* round up to power of two */
+    while (q_size < size)
+        q_size <<= 1;
+
+    memset (q, 0x00, sizeof(queue_t));
+    q->size   = q_size;
+    q->mask   = q_size - 1;
+    q->evt_fd = -1;
+    q->buf    = (__u8 *)(malloc(q_size));
+
+    return  (q->buf != NULL) ? true : false;
+}
+
+//------------------------------------------------------------------------------
+void queue_free (queue_t *q)
+{
+    if (q->buf)
+        free (q->buf);
+    q->buf = NULL;
+}
+
+//------------------------------------------------------------------------------
+__u32 queue_count (queue_t *q)
+{
+    return  atomic_load_explicit (&q->ep, memory_order_acquire) -
+            atomic_load_explicit (&q->sp, memory_order_acquire);
+}
+
+//------------------------------------------------------------------------------
+__u32 queue_space (queue_t *q)
+{
+    return  q->size - queue_count (q);
+}
+
+//------------------------------------------------------------------------------
+// producer side : free space of the ring as (max 2) iovec, then commit.
+//------------------------------------------------------------------------------
+int queue_wr_iov (queue_t *q, struct iovec *iov)
+{
+    __u32 ep  = atomic_load_explicit (&q->ep, memory_order_relaxed);
+    __u32 sp  = atomic_load_explicit (&q->sp, memory_order_acquire);
+    __u32 len = q->size - (ep - sp), pos = ep & q->mask;
+
+    if (!len)
+        return  0;
+
+    iov[0].iov_base = &q->buf[pos];
+    if ((pos + len) > q->size) {
+        iov[0].iov_len  = q->size - pos;
+        iov[1].iov_base = &q->buf[0];
+        iov[1].iov_len  = len - iov[0].iov_len;
+        return  2;
     }
-    return  true;
+    iov[0].iov_len  = len;
+    return  1;
+}
+
+//------------------------------------------------------------------------------
+void queue_wr_commit (queue_t *q, __u32 n)
+{
+    __u32 ep = atomic_load_explicit (&q->ep, memory_order_relaxed) + n;
+    __u32 cnt;
+
+    if (!n)
+        return;
+
+    /* publish the data written before the new ep */
+    atomic_store_explicit (&q->ep, ep, memory_order_release);
+
+    cnt = ep - atomic_load_explicit (&q->sp, memory_order_relaxed);
+    if (cnt > atomic_load_explicit (&q->hwm, memory_order_relaxed))
+        atomic_store_explicit (&q->hwm, cnt, memory_order_relaxed);
+
+    /* wake up the consumer thread (eventfd counter, no lost wakeup) */
+    if (q->evt_fd >= 0)
+        eventfd_write (q->evt_fd, 1);
+}
+
+//------------------------------------------------------------------------------
+// consumer side : queued data of the ring as (max 2) iovec, then commit.
+//------------------------------------------------------------------------------
+int queue_rd_iov (queue_t *q, struct iovec *iov)
+{
+    __u32 sp  = atomic_load_explicit (&q->sp, memory_order_relaxed);
+    __u32 ep  = atomic_load_explicit (&q->ep, memory_order_acquire);
+    __u32 len = ep - sp, pos = sp & q->mask;
+
+    if (!len)
+        return  0;
+
+    iov[0].iov_base = &q->buf[pos];
+    if ((pos + len) > q->size) {
+        iov[0].iov_len  = q->size - pos;
+        iov[1].iov_base = &q->buf[0];
+        iov[1].iov_len  = len - iov[0].iov_len;
+        return  2;
+    }
+    iov[0].iov_len  = len;
+    return  1;
+}
+
+//------------------------------------------------------------------------------
+void queue_rd_commit (queue_t *q, __u32 n)
+{
+    __u32 sp = atomic_load_explicit (&q->sp, memory_order_relaxed);
+
+    /* release the slots only after the data has been copied out */
+    atomic_store_explicit (&q->sp, sp + n, memory_order_release);
+}
+
+//------------------------------------------------------------------------------
+static __u32 iov_copy (struct iovec *iov, int iov_cnt, __u8 *d, __u32 n, bool to_iov)
+{
+    __u32 len, done = 0;
+    int i;
+
+    for (i = 0; (i < iov_cnt) && (done < n); i++) {
+        len = (iov[i].iov_len < (n - done)) ? iov[i].iov_len : (n - done);
+        if (to_iov) memcpy (iov[i].iov_base, &d[done], len);
+        else        memcpy (&d[done], iov[i].iov_base, len);
+        done += len;
+    }
+    return  done;
+}
+
+//------------------------------------------------------------------------------
+// put n bytes with a single consumer wakeup, return the number of bytes queued.
+// a full queue drops the remaining (newest) bytes and counts them as overflow.
+//------------------------------------------------------------------------------
+__u32 queue_put_n (queue_t *q, const __u8 *d, __u32 n)
+{
+    struct iovec iov[2];
+    __u32 done = 0;
+    int iov_cnt;
+
+    if ((iov_cnt = queue_wr_iov (q, iov)))
+        done = iov_copy (iov, iov_cnt, (__u8 *)d, n, true);
+
+    if (done != n)
+        atomic_fetch_add_explicit (&q->overflow, n - done, memory_order_relaxed);
+
+    queue_wr_commit (q, done);
+    return  done;
+}
+
+//------------------------------------------------------------------------------
+bool queue_put (queue_t *q, __u8 *d)
+{
+    return  queue_put_n (q, d, 1) ? true : false;
+}
+
+//------------------------------------------------------------------------------
+// copy max n bytes from the queue without removing them.
+//------------------------------------------------------------------------------
+__u32 queue_peek (queue_t *q, __u8 *d, __u32 n)
+{
+    struct iovec iov[2];
+    int iov_cnt;
+
+    if ((iov_cnt = queue_rd_iov (q, iov)))
+        return  iov_copy (iov, iov_cnt, d, n, false);
+    return  0;
+}
+
+//------------------------------------------------------------------------------
+__u32 queue_get_n (queue_t *q, __u8 *d, __u32 n)
+{
+    __u32 done = queue_peek (q, d, n);
+
+    if (done)
+        queue_rd_commit (q, done);
+    return  done;
 }
 
 //------------------------------------------------------------------------------
 bool queue_get (queue_t *q, __u8 *d)
 {
-    if (q->ep != q->sp) {
-        *d = q->buf[q->sp++];
-        if (q->sp >= q->size)   q->sp = 0;
-        return  true;
+    return  queue_get_n (q, d, 1) ? true : false;
+}
+
+//------------------------------------------------------------------------------
+// read the uart into the free space of the queue (including the ring wrap)
+//------------------------------------------------------------------------------
+static int queue_fill_fd (queue_t *q, ptc_grp_t *ptc_grp)
+{
+    struct iovec iov[2];
+    int iov_cnt, ret;
+
+    /* queue full : the data is dropped to keep the rx fifo of the kernel empty */
+    if (!(iov_cnt = queue_wr_iov (q, iov))) {
+        __u8 drop[64];
+        iov[0].iov_base = drop;     iov[0].iov_len = sizeof(drop);
+        if ((ret = ptc_grp->tp->read (ptc_grp, iov, 1)) > 0) {
+            atomic_fetch_add_explicit (&q->overflow, ret, memory_order_relaxed);
+            atomic_fetch_add_explicit (&ptc_grp->rx_bytes, ret, memory_order_relaxed);
+        }
+        return  ret;
     }
-    // queue empty
-    return false;
+
+    if ((ret = ptc_grp->tp->read (ptc_grp, iov, iov_cnt)) > 0) {
+        queue_wr_commit (q, ret);
+        atomic_fetch_add_explicit (&ptc_grp->rx_bytes, ret, memory_order_relaxed);
+    }
+    return  ret;
 }
 
 //------------------------------------------------------------------------------
-void *rx_thread_func (void *arg)
+// write all queued data to the uart (including the ring wrap)
+//------------------------------------------------------------------------------
+static int queue_drain_fd (queue_t *q, ptc_grp_t *ptc_grp)
 {
-    __u8 d;
-    ptc_grp_t *ptc_grp = (ptc_grp_t *)arg;
+    struct iovec iov[2];
+    int iov_cnt, ret, total = 0;
+
+    while ((iov_cnt = queue_rd_iov (q, iov))) {
+        if ((ret = ptc_grp->tp->write (ptc_grp, iov, iov_cnt)) <= 0)
+            break;
+        queue_rd_commit (q, ret);
+        total += ret;
+    }
+    if (total)
+        atomic_fetch_add_explicit (&ptc_grp->tx_bytes, total, memory_order_relaxed);
+    return  total;
+}
 
-    while(true) {
-        if (read (ptc_grp->fd, &d, 1))      queue_put (&ptc_grp->rx_q, &d);
-        usleep(50);
+//------------------------------------------------------------------------------
+//   UART IO reactor
+//   one thread multiplexes the uart fd and tx eventfd of every opened ptc_grp_t.
+//------------------------------------------------------------------------------
+#define REACTOR_EVENT_MAX   16
+
+static struct {
+    pthread_mutex_t lock;
+    /* pass : count of dispatched epoll_wait results (for uart_reactor_del) */
+    pthread_cond_t  cond;
+    __u32           pass;
+
+    pthread_t       thread;
+    int             epfd, wake_fd;
+    bool            running;
+}   Reactor = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+//------------------------------------------------------------------------------
+static void reactor_tx_wait (ptc_grp_t *ptc_grp, bool wait)
+{
+    struct epoll_event ev;
+
+    if (ptc_grp->tx_wait == wait)
+        return;
+
+    ev.events   = wait ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.ptr = &ptc_grp->ev_uart;
+    epoll_ctl (Reactor.epfd, EPOLL_CTL_MOD, ptc_grp->tp->poll (ptc_grp), &ev);
+    ptc_grp->tx_wait = wait;
+}
+
+//------------------------------------------------------------------------------
+// link is dead : stop watching the fd (level triggered HUP) and wake the owner
+// of the rx queue, which closes the group (ptc_link_lost).
+//------------------------------------------------------------------------------
+static void reactor_link_lost (ptc_grp_t *ptc_grp)
+{
+    epoll_ctl (Reactor.epfd, EPOLL_CTL_DEL, ptc_grp->tp->poll (ptc_grp), NULL);
+    ptc_grp->link_lost = true;
+    eventfd_write (ptc_grp->rx_q.evt_fd, 1);
+}
+
+//------------------------------------------------------------------------------
+static void reactor_dispatch (io_event_t *ev, __u32 events)
+{
+    ptc_grp_t *ptc_grp = ev->grp;
+    eventfd_t cnt;
+
+    if (ev->type == IO_EVENT_TX) {
+        eventfd_read (ptc_grp->tx_q.evt_fd, &cnt);
+        /* EPOLLOUT is already armed, the uart event drains the queue */
+        if (!ptc_grp->tx_wait) {
+            queue_drain_fd (&ptc_grp->tx_q, ptc_grp);
+            if (queue_count (&ptc_grp->tx_q))
+                reactor_tx_wait (ptc_grp, true);
+        }
+        return;
+    }
+
+    /* non-blocking tcp connect finished : SO_ERROR is the connect result */
+    if (ptc_grp->connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        socklen_t len = sizeof(int);
+        int so_err = 0;
+
+        if (getsockopt (ptc_grp->fd, SOL_SOCKET, SO_ERROR, &so_err, &len) || so_err) {
+            err ("%s fd %d connect error : %s\n", ptc_grp->tp->name, ptc_grp->fd,
+                strerror(so_err ? so_err : errno));
+            reactor_link_lost (ptc_grp);
+            return;
+        }
+        ptc_grp->connecting = false;
+        info ("%s fd %d connected.\n", ptc_grp->tp->name, ptc_grp->fd);
+    }
+
+    /* device removed, peer closed */
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        err ("%s fd %d hangup (events = 0x%x)\n", ptc_grp->tp->name, ptc_grp->fd, events);
+        reactor_link_lost (ptc_grp);
+        return;
+    }
+    if (events & EPOLLIN) {
+        int ret;
+
+        while ((ret = queue_fill_fd (&ptc_grp->rx_q, ptc_grp)) > 0);
+        /* link lost (e.g. tcp peer closed) */
+        if ((ret < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+            err ("%s fd %d read error : %s\n", ptc_grp->tp->name, ptc_grp->fd, strerror(errno));
+            reactor_link_lost (ptc_grp);
+            return;
+        }
+    }
+
+    if (events & EPOLLOUT) {
+        queue_drain_fd (&ptc_grp->tx_q, ptc_grp);
+        if (!queue_count (&ptc_grp->tx_q))
+            reactor_tx_wait (ptc_grp, false);
     }
 }
 
 //------------------------------------------------------------------------------
-void *tx_thread_func (void *arg)
+static void *reactor_thread_func (void *arg)
 {
-    __u8 d;
-    ptc_grp_t *ptc_grp = (ptc_grp_t *)arg;
+    struct epoll_event evs[REACTOR_EVENT_MAX];
+    eventfd_t cnt;
+    int i, ev_cnt;
+
+    (void)arg;
+
+    while (true) {
+        /* sleep in the kernel until any uart is readable or has tx data */
+        ev_cnt = epoll_wait (Reactor.epfd, evs, REACTOR_EVENT_MAX, -1);
+
+        pthread_mutex_lock (&Reactor.lock);
+        for (i = 0; i < ev_cnt; i++) {
+            if (evs[i].data.ptr == NULL)
+                eventfd_read (Reactor.wake_fd, &cnt);
+            else
+                reactor_dispatch ((io_event_t *)evs[i].data.ptr, evs[i].events);
+        }
+        Reactor.pass++;
+        pthread_cond_broadcast (&Reactor.cond);
+        pthread_mutex_unlock (&Reactor.lock);
+    }
+    return NULL;
+}
 
-    while(true) {
-        if (queue_get(&ptc_grp->tx_q, &d))   write (ptc_grp->fd, &d, 1);
-        usleep(50);
+//------------------------------------------------------------------------------
+static bool reactor_start (void)
+{
+    struct epoll_event ev;
+
+    if ((Reactor.epfd = epoll_create1 (EPOLL_CLOEXEC)) < 0)
+        return false;
+    if ((Reactor.wake_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        close (Reactor.epfd);
+        return false;
     }
+    ev.events   = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl (Reactor.epfd, EPOLL_CTL_ADD, Reactor.wake_fd, &ev);
+
+    if (pthread_create (&Reactor.thread, NULL, reactor_thread_func, NULL)) {
+        close (Reactor.wake_fd);
+        close (Reactor.epfd);
+        return false;
+    }
+    info ("uart io reactor started.\n");
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// channel register : the reactor thread is created on the first register.
+//------------------------------------------------------------------------------
+bool uart_reactor_add (ptc_grp_t *ptc_grp)
+{
+    struct epoll_event ev;
+    bool ret = false;
+
+    pthread_mutex_lock (&Reactor.lock);
+    if (!Reactor.running)
+        Reactor.running = reactor_start ();
+
+    if (Reactor.running) {
+        ptc_grp->ev_uart.grp  = ptc_grp;  ptc_grp->ev_uart.type = IO_EVENT_UART;
+        ptc_grp->ev_tx.grp    = ptc_grp;  ptc_grp->ev_tx.type   = IO_EVENT_TX;
+        /* a connecting fd waits for EPOLLOUT, tx data is drained after the connect */
+        ptc_grp->tx_wait      = ptc_grp->connecting;
+
+        ev.events   = ptc_grp->tx_wait ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+        ev.data.ptr = &ptc_grp->ev_uart;
+        if (!epoll_ctl (Reactor.epfd, EPOLL_CTL_ADD, ptc_grp->tp->poll (ptc_grp), &ev)) {
+            ev.events   = EPOLLIN;
+            ev.data.ptr = &ptc_grp->ev_tx;
+            if (!epoll_ctl (Reactor.epfd, EPOLL_CTL_ADD, ptc_grp->tx_q.evt_fd, &ev))
+                ret = true;
+            else
+                epoll_ctl (Reactor.epfd, EPOLL_CTL_DEL, ptc_grp->tp->poll (ptc_grp), NULL);
+        }
+    }
+    pthread_mutex_unlock (&Reactor.lock);
+    return ret;
+}
+
+//------------------------------------------------------------------------------
+// channel unregister : returns after the reactor has finished the epoll_wait
+// result that may still reference ptc_grp, the caller can close and free it.
+//------------------------------------------------------------------------------
+void uart_reactor_del (ptc_grp_t *ptc_grp)
+{
+    __u32 pass;
+
+    pthread_mutex_lock (&Reactor.lock);
+    if (Reactor.running) {
+        epoll_ctl (Reactor.epfd, EPOLL_CTL_DEL, ptc_grp->tp->poll (ptc_grp), NULL);
+        epoll_ctl (Reactor.epfd, EPOLL_CTL_DEL, ptc_grp->tx_q.evt_fd, NULL);
+
+        pass = Reactor.pass;
+        eventfd_write (Reactor.wake_fd, 1);
+        while (pass == Reactor.pass)
+            pthread_cond_wait (&Reactor.cond, &Reactor.lock);
+    }
+    pthread_mutex_unlock (&Reactor.lock);
 }
 
 //------------------------------------------------------------------------------
@@ -93,52 +512,117 @@ void ptc_set_status (ptc_grp_t *ptc_grp, __u8 ptc_num, bool status)
 }
 
 //------------------------------------------------------------------------------
-// data save to protocol q
+// rx queue data move to the protocol buffers (one copy per open protocol).
+// the unprocessed bytes are moved to the buffer start, so previous frame
+// views are invalid after this call.
 //------------------------------------------------------------------------------
-void ptc_q (ptc_grp_t *ptc_grp, __u8 ptc_num, __u8 idata)
+__u32 ptc_feed (ptc_grp_t *ptc_grp)
 {
-	ptc_grp->p[ptc_num].var.p_ep %= ptc_grp->p[ptc_num].var.size;
-	if (ptc_grp->p[ptc_num].var.p_ep == ptc_grp->p[ptc_num].var.p_sp)
-	{
-		ptc_grp->p[ptc_num].var.p_sp++;
-		ptc_grp->p[ptc_num].var.p_sp %= ptc_grp->p[ptc_num].var.size;
-	}
-	ptc_grp->p[ptc_num].var.buf[ptc_grp->p[ptc_num].var.p_ep++] = idata;
+    __u8 ptc_pos;
+    __u32 len = queue_count (&ptc_grp->rx_q), free_sz, cnt;
+    ptc_var_t *var;
+
+    if (!len)
+        return 0;
+
+    /* no open protocol : rx data is discarded */
+    cnt = len;
+
+    for (ptc_pos = 0; ptc_pos < ptc_grp->pcnt; ptc_pos++) {
+        var = &ptc_grp->p[ptc_pos].var;
+        if (!var->open)
+            continue;
+        if (var->p_sp) {
+            memmove (var->buf, &var->buf[var->p_sp], var->p_ep - var->p_sp);
+            var->p_ep -= var->p_sp;     var->p_sp = 0;
+        }
+        free_sz = var->buf_size - var->p_ep;
+        len = (len < free_sz) ? len : free_sz;
+    }
+
+    for (ptc_pos = 0; ptc_pos < ptc_grp->pcnt; ptc_pos++) {
+        var = &ptc_grp->p[ptc_pos].var;
+        if (!var->open)
+            continue;
+        cnt = queue_peek (&ptc_grp->rx_q, &var->buf[var->p_ep], len);
+        var->p_ep += cnt;
+    }
+    queue_rd_commit (&ptc_grp->rx_q, cnt);
+    return cnt;
 }
 
 //------------------------------------------------------------------------------
-//   Protocol check & data atch fron Q Buffer
+// bytes between frames : line end (\n\r) of the ascii frame is not a resync
 //------------------------------------------------------------------------------
-void ptc_event (ptc_grp_t *ptc_grp, __u8 idata)
+static bool ptc_gap_filler (const __u8 *d, __u32 n)
 {
-    __u8 ptc_pos;
+    while (n--) {
+        if ((*d != '\n') && (*d != '\r'))
+            return false;
+        d++;
+    }
+    return true;
+}
 
-	for (ptc_pos = 0; ptc_pos < ptc_grp->pcnt; ptc_pos++)	{
-		if (ptc_grp->p[ptc_pos].var.open)	{
-			ptc_q (ptc_grp, ptc_pos, idata);
-			if (ptc_grp->p[ptc_pos].pcheck (&ptc_grp->p[ptc_pos].var))	{
-				if (ptc_grp->p[ptc_pos].pcatch (&ptc_grp->p[ptc_pos].var))	{
-                    ptc_grp->p[ptc_pos].var.pass = true;
-					ptc_set_status (ptc_grp, ptc_pos, false);
-				}
-			}
-		}
-	}
+//------------------------------------------------------------------------------
+//   Protocol frame extract from the protocol buffer
+//   head byte is found with memchr, a bad window skips to the next head.
+//------------------------------------------------------------------------------
+bool ptc_frame_get (ptc_grp_t *ptc_grp, __u8 ptc_num, ptc_frame_t *frame)
+{
+    ptc_func_t *p = &ptc_grp->p[ptc_num];
+    ptc_var_t *var = &p->var;
+    __u8 *pos;
+    int len;
+
+    if (!var->open)
+        return false;
+
+    while (var->p_sp < var->p_ep) {
+        if ((pos = memchr (&var->buf[var->p_sp], p->head, var->p_ep - var->p_sp)) == NULL) {
+            /* no head byte in the buffer : drop all */
+            if (!ptc_gap_filler (&var->buf[var->p_sp], var->p_ep - var->p_sp))
+                p->resync++;
+            var->p_sp = var->p_ep = 0;
+            break;
+        }
+        if (!ptc_gap_filler (&var->buf[var->p_sp], pos - &var->buf[var->p_sp]))
+            p->resync++;
+        var->p_sp = pos - var->buf;
+
+        if ((len = p->pcheck (var)) == 0)
+            break;
+
+        if ((len > 0) && p->pcatch (var)) {
+            frame->data = &var->buf[var->p_sp];
+            frame->len  = len;
+            var->p_sp  += len;
+            p->frame_good++;
+            return true;
+        }
+        /* resync : skip this head byte */
+        p->frame_bad++;
+        var->p_sp++;
+    }
+    return false;
 }
 
 //------------------------------------------------------------------------------
 //   UART Protocol Initiliaze Function
 //------------------------------------------------------------------------------
-bool ptc_func_init (ptc_grp_t *ptc_grp, __u8 ptc_num, __u8 ptc_size, 
+bool ptc_func_init (ptc_grp_t *ptc_grp, __u8 ptc_num, __u32 ptc_size, __u8 head,
     int (*chk_func)(ptc_var_t *var), int (*cat_func)(ptc_var_t *var))
 {
     ptc_grp->p[ptc_num].var.p_ep = 0;
     ptc_grp->p[ptc_num].var.p_sp = 0;
     ptc_grp->p[ptc_num].var.open = 1;
-    ptc_grp->p[ptc_num].var.pass = 0;
 
-    ptc_grp->p[ptc_num].var.size = ptc_size;
-    ptc_grp->p[ptc_num].var.buf  = (__u8 *)(malloc(sizeof(__u8) * ptc_size));
+    /* one frame + a full rx queue can be held in the protocol buffer */
+    ptc_grp->p[ptc_num].var.size     = ptc_size;
+    ptc_grp->p[ptc_num].var.buf_size = ptc_size + ptc_grp->rx_q.size;
+    ptc_grp->p[ptc_num].var.buf  =
+        (__u8 *)(malloc(sizeof(__u8) * ptc_grp->p[ptc_num].var.buf_size));
+    ptc_grp->p[ptc_num].head     = head;
     ptc_grp->p[ptc_num].pcheck   = chk_func;
     ptc_grp->p[ptc_num].pcatch   = cat_func;
 
@@ -146,7 +630,8 @@ bool ptc_func_init (ptc_grp_t *ptc_grp, __u8 ptc_num, __u8 ptc_size,
         (ptc_grp->p[ptc_num].var.buf == NULL))
         return false;
 
-    memset (ptc_grp->p[ptc_num].var.buf, 0x00, sizeof(__u8) * ptc_size);
+    memset (ptc_grp->p[ptc_num].var.buf, 0x00,
+        sizeof(__u8) * ptc_grp->p[ptc_num].var.buf_size);
     return true;
 }
 
@@ -169,116 +654,275 @@ void ptc_grp_close (ptc_grp_t *ptc_grp)
 {
     __u8 ptc_pos;
 
-    /* destroy pthread for tx / rx */
-    {
-        int ret;
-        ret = pthread_detach(ptc_grp->rx_thread);
-        info ("rx thread detach = %d\n", ret);
-        ret = pthread_detach(ptc_grp->tx_thread);
-        info ("tx thread detach = %d\n", ret);
-    }
+    if (ptc_grp->tx_q.evt_fd >= 0)
+        close (ptc_grp->tx_q.evt_fd);
+    if (ptc_grp->rx_q.evt_fd >= 0)
+        close (ptc_grp->rx_q.evt_fd);
 
-	for (ptc_pos = 0; ptc_pos < ptc_grp->pcnt; ptc_pos++)
+    for (ptc_pos = 0; ptc_pos < ptc_grp->pcnt; ptc_pos++) {
         free (ptc_grp->p[ptc_pos].var.buf);
+        free (ptc_grp->p[ptc_pos].var.priv);
+    }
 
+    queue_free (&ptc_grp->tx_q);
+    queue_free (&ptc_grp->rx_q);
+    free (ptc_grp->priv);
     free (ptc_grp->p);
     free (ptc_grp);
 }
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-ptc_grp_t *uart_init (const char *dev_name, speed_t baud)
+// link lost (hangup, read error) : the group has to be closed and opened again
+//------------------------------------------------------------------------------
+bool ptc_link_lost (ptc_grp_t *ptc_grp)
 {
-    int fd;
-    unsigned char buf;
-    // Create new termios struct, we call it 'tty' for convention
-    struct termios tty;
+    return  (ptc_grp != NULL) ? ptc_grp->link_lost : false;
+}
+
+//------------------------------------------------------------------------------
+// link statistics. the frame counters are owned by the protocol consumer,
+// call from the thread that runs ptc_frame_get.
+//------------------------------------------------------------------------------
+bool ptc_stats_get (ptc_grp_t *ptc_grp, ptc_stats_t *stats)
+{
+    struct serial_icounter_struct icount;
+    int i;
+
+    if (ptc_grp == NULL)
+        return false;
 
+    memset (stats, 0x00, sizeof(ptc_stats_t));
+    stats->rx_bytes     = atomic_load_explicit (&ptc_grp->rx_bytes, memory_order_relaxed);
+    stats->tx_bytes     = atomic_load_explicit (&ptc_grp->tx_bytes, memory_order_relaxed);
+    stats->pcnt         = (ptc_grp->pcnt < PTC_STATS_MAX) ? ptc_grp->pcnt : PTC_STATS_MAX;
+    for (i = 0; i < stats->pcnt; i++) {
+        stats->frame_good[i] = ptc_grp->p[i].frame_good;
+        stats->frame_bad[i]  = ptc_grp->p[i].frame_bad;
+        stats->resync[i]     = ptc_grp->p[i].resync;
+    }
+    stats->rx_overflow  = atomic_load_explicit (&ptc_grp->rx_q.overflow, memory_order_relaxed);
+    stats->tx_overflow  = atomic_load_explicit (&ptc_grp->tx_q.overflow, memory_order_relaxed);
+    stats->rx_hwm       = atomic_load_explicit (&ptc_grp->rx_q.hwm, memory_order_relaxed);
+    stats->tx_hwm       = atomic_load_explicit (&ptc_grp->tx_q.hwm, memory_order_relaxed);
+
+    /* uart line errors counted by the serial driver */
+    if (ioctl (ptc_grp->fd, TIOCGICOUNT, &icount) < 0) {
+        stats->overrun = stats->buf_overrun = -1;
+        stats->parity  = stats->frame = stats->brk = -1;
+    } else {
+        stats->overrun      = icount.overrun;
+        stats->buf_overrun  = icount.buf_overrun;
+        stats->parity       = icount.parity;
+        stats->frame        = icount.frame;
+        stats->brk          = icount.brk;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void ptc_stats_dump (ptc_grp_t *ptc_grp, const char *name)
+{
+    ptc_stats_t s;
+    int i;
+
+    if (!ptc_stats_get (ptc_grp, &s))
+        return;
+
+    info ("%s : rx %u bytes, tx %u bytes\n", name, s.rx_bytes, s.tx_bytes);
+    for (i = 0; i < s.pcnt; i++)
+        info ("%s : protocol %d frame good %u, bad %u, resync %u\n",
+            name, i, s.frame_good[i], s.frame_bad[i], s.resync[i]);
+    info ("%s : rx_q overflow %u, hwm %u / %u, tx_q overflow %u, hwm %u / %u\n",
+            name, s.rx_overflow, s.rx_hwm, ptc_grp->rx_q.size,
+            s.tx_overflow, s.tx_hwm, ptc_grp->tx_q.size);
+    if (s.overrun >= 0)
+        info ("%s : uart overrun %d, buf_overrun %d, parity %d, frame %d, break %d\n",
+            name, s.overrun, s.buf_overrun, s.parity, s.frame, s.brk);
+}
+
+//------------------------------------------------------------------------------
+// protocol group on a transport, rx / tx is served by the io reactor thread
+// rx_q.evt_fd : readable when received data is queued (consumer epoll)
+//------------------------------------------------------------------------------
+ptc_grp_t *ptc_grp_open (const transport_t *tp, const char *addr, int param)
+{
     ptc_grp_t *ptc_grp;
 
-    if ((fd = open(dev_name, O_RDWR)) < 0) {
-        printf("%s open error!\n", dev_name);
+    /* UART control struct init */
+    if ((ptc_grp = (ptc_grp_t *)(malloc(sizeof(ptc_grp_t)))) == NULL)
         return NULL;
-    }
 
-    // Read in existing settings, and handle any error
-    if(tcgetattr(fd, &tty) != 0) {
-        printf("Error %i from tcgetattr: %s\n", errno, strerror(errno));
-        close(fd);
+    memset (ptc_grp, 0x00, sizeof(ptc_grp_t));
+    ptc_grp->tp = tp;
+    ptc_grp->tx_q.evt_fd = -1;
+    ptc_grp->rx_q.evt_fd = -1;
+
+    if (tp->open (ptc_grp, addr, param) < 0) {
+        free (ptc_grp);
         return NULL;
     }
-
-    tty.c_cflag &= ~PARENB; // Clear parity bit, disabling parity (most common)
-    tty.c_cflag &= ~CSTOPB; // Clear stop field, only one stop bit used in communication (most common)
-    tty.c_cflag &= ~CSIZE; // Clear all bits that set the data size 
-    tty.c_cflag |= CS8; // 8 bits per byte (most common)
-    tty.c_cflag &= ~CRTSCTS; // Disable RTS/CTS hardware flow control (most common)
-    tty.c_cflag |= CREAD | CLOCAL; // Turn on READ & ignore ctrl lines (CLOCAL = 1)
-
-    tty.c_lflag &= ~ICANON;
-    tty.c_lflag &= ~ECHO; // Disable echo
-    tty.c_lflag &= ~ECHOE; // Disable erasure
-    tty.c_lflag &= ~ECHONL; // Disable new-line echo
-    tty.c_lflag &= ~ISIG; // Disable interpretation of INTR, QUIT and SUSP
-    tty.c_iflag &= ~(IXON | IXOFF | IXANY); // Turn off s/w flow ctrl
-    tty.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP|INLCR|IGNCR|ICRNL); // Disable any special handling of received bytes
-
-    tty.c_oflag &= ~OPOST; // Prevent special interpretation of output bytes (e.g. newline chars)
-    tty.c_oflag &= ~ONLCR; // Prevent conversion of newline to carriage return/line feed
-    // tty.c_oflag &= ~OXTABS; // Prevent conversion of tabs to spaces (NOT PRESENT ON LINUX)
-    // tty.c_oflag &= ~ONOEOT; // Prevent removal of C-d chars (0x004) in output (NOT PRESENT ON LINUX)
-
-    //tty.c_cc[VTIME] = 10;    // Wait for up to 1s (10 deciseconds), returning as soon as any data is received.
-    tty.c_cc[VTIME] = 0;    
-    tty.c_cc[VMIN] = 0;
-    
-    // Set in/out baud rate to be 115200
-    cfsetispeed(&tty, baud);
-    cfsetospeed(&tty, baud);
-
-    // Save tty settings, also checking for error
-    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
-        printf("Error %i from tcsetattr: %s\n", errno, strerror(errno));
-        close(fd);
+    if (!queue_init (&ptc_grp->tx_q, DEFAULT_QUEUE_SIZE) ||
+        !queue_init (&ptc_grp->rx_q, DEFAULT_QUEUE_SIZE) ||
+        ((ptc_grp->tx_q.evt_fd = eventfd (0, EFD_CLOEXEC)) < 0) ||
+        ((ptc_grp->rx_q.evt_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)) {
+        err ("rx/tx queue create error!\n");
+        tp->close (ptc_grp);
+        ptc_grp_close (ptc_grp);
         return NULL;
     }
-    while(read(fd, &buf, 1));    // read all if there is data in the serial rx buffer
-
-    /* UART control struct init */
-    if ((ptc_grp = (ptc_grp_t *)(malloc(sizeof(ptc_grp_t)))) != NULL) {
-        memset (ptc_grp, 0x00, sizeof(ptc_grp_t));
-        ptc_grp->fd         = fd;
-
-        ptc_grp->tx_q.sp    = 0;
-        ptc_grp->tx_q.ep    = 0;
-        ptc_grp->tx_q.size  = DEFAULT_QUEUE_SIZE;
-        ptc_grp->tx_q.buf   = (__u8 *)(malloc(DEFAULT_QUEUE_SIZE));
-
-        ptc_grp->rx_q.sp    = 0;
-        ptc_grp->rx_q.ep    = 0;
-        ptc_grp->rx_q.size  = DEFAULT_QUEUE_SIZE;
-        ptc_grp->rx_q.buf   = (__u8 *)(malloc(DEFAULT_QUEUE_SIZE));
-
-        if ((ptc_grp->tx_q.buf == NULL) || (ptc_grp->rx_q.buf == NULL)) {
-            err ("rx/tx queue create error!\n");
-            free (ptc_grp);
-            return NULL;
-        }
-        /* Create pthread for tx / rx */
-        pthread_create(&ptc_grp->rx_thread, NULL, rx_thread_func, ptc_grp);
-        pthread_create(&ptc_grp->tx_thread, NULL, tx_thread_func, ptc_grp);
-        return ptc_grp;
+    if (!uart_reactor_add (ptc_grp)) {
+        err ("%s io reactor register error!\n", addr);
+        tp->close (ptc_grp);
+        ptc_grp_close (ptc_grp);
+        return NULL;
     }
-    return NULL;
+    return ptc_grp;
+}
+
+//------------------------------------------------------------------------------
+// addr : "tcp:host:port", "pty:[link]" or uart device node (param : Bxxx)
+//------------------------------------------------------------------------------
+ptc_grp_t *ptc_open (const char *addr, int param)
+{
+    const transport_t *tp;
+    const char *dev;
+
+    tp = transport_find (addr, &dev);
+    return  ptc_grp_open (tp, dev, param);
+}
+
+//------------------------------------------------------------------------------
+ptc_grp_t *uart_init (const char *dev_name, speed_t baud)
+{
+    return  ptc_grp_open (&transport_uart, dev_name, baud);
 }
 
 //------------------------------------------------------------------------------
 void uart_close (ptc_grp_t *ptc_grp)
 {
-    if (ptc_grp->fd)
-        close(ptc_grp->fd);
+    uart_reactor_del (ptc_grp);
+
+    ptc_grp->tp->close (ptc_grp);
 
     ptc_grp_close (ptc_grp);
 }
 
+//------------------------------------------------------------------------------
+// baud rate(bps) to termios speed, 0 : not supported
+//------------------------------------------------------------------------------
+speed_t uart_baud_speed (int baud_rate)
+{
+    switch (baud_rate) {
+        case    115200:     return  B115200;
+        case    230400:     return  B230400;
+        case    460800:     return  B460800;
+        case    921600:     return  B921600;
+        case    1000000:    return  B1000000;
+        case    1500000:    return  B1500000;
+        case    2000000:    return  B2000000;
+        case    3000000:    return  B3000000;
+        default :
+            return  0;
+    }
+}
+
+//------------------------------------------------------------------------------
+// change the line speed of an open uart.
+// queued tx data is sent at the old speed first, rx data in the uart fifo
+// received during the change is discarded.
+//------------------------------------------------------------------------------
+bool uart_set_baud (ptc_grp_t *ptc_grp, speed_t baud)
+{
+    struct termios tty;
+    int wait_ms = 100;
+
+    /* tx queue is drained by the io reactor thread */
+    while (queue_count (&ptc_grp->tx_q) && wait_ms--)
+        usleep (1000);
+    tcdrain (ptc_grp->fd);
+
+    if (tcgetattr (ptc_grp->fd, &tty) != 0) {
+        err ("Error %i from tcgetattr: %s\n", errno, strerror(errno));
+        return false;
+    }
+    cfsetispeed (&tty, baud);
+    cfsetospeed (&tty, baud);
+
+    if (tcsetattr (ptc_grp->fd, TCSANOW, &tty) != 0) {
+        err ("Error %i from tcsetattr: %s\n", errno, strerror(errno));
+        return false;
+    }
+    tcflush (ptc_grp->fd, TCIFLUSH);
+    ptc_grp->baud = baud;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// usb-serial rx latency timer (FTDI : default 16 ms).
+// the adapter holds rx data up to latency timer before the usb transfer,
+// that is most of the round trip of a short command/response frame.
+// latency_ms < 0 : read only. return : latency timer before the change,
+// -1 : not a usb-serial adapter with a latency timer (cp210x, ch341, pty...)
+//------------------------------------------------------------------------------
+int uart_latency_timer (const char *dev_name, int latency_ms)
+{
+    char path[128], link[128], name[64], *tty;
+    FILE *fp;
+    int latency = -1;
+
+    memset  (name, 0x00, sizeof(name));
+    strncpy (name, dev_name, sizeof(name) -1);
+    tty = basename (name);
+
+    /* adapter type : usb-serial driver name */
+    memset  (link, 0x00, sizeof(link));
+    sprintf (path, "/sys/bus/usb-serial/devices/%s/driver", tty);
+    if (readlink (path, link, sizeof(link) -1) < 0)
+        return  -1;
+
+    sprintf (path, "/sys/bus/usb-serial/devices/%s/latency_timer", tty);
+    if ((fp = fopen (path, "r")) == NULL) {
+        info ("%s : %s, no latency timer\n", dev_name, basename (link));
+        return  -1;
+    }
+    if (fscanf (fp, "%d", &latency) != 1)
+        latency = -1;
+    fclose (fp);
+
+    if ((latency_ms >= 0) && (latency != latency_ms)) {
+        if ((fp = fopen (path, "w")) != NULL) {
+            fprintf (fp, "%d", latency_ms);
+            if (fclose (fp))
+                err ("%s : latency timer write error! (%s)\n", dev_name, strerror(errno));
+        } else
+            err ("%s : %s open error! (%s)\n", dev_name, path, strerror(errno));
+    }
+    info ("%s : %s, latency timer %d ms -> %d ms\n", dev_name, basename (link),
+            latency, (latency_ms >= 0) ? latency_ms : latency);
+    return  latency;
+}
+
+//------------------------------------------------------------------------------
+// ASYNC_LOW_LATENCY : rx data is pushed to the tty layer without the flip
+// buffer work delay (usb-serial drivers that honour it also lower the timer).
+//------------------------------------------------------------------------------
+bool uart_low_latency (ptc_grp_t *ptc_grp)
+{
+    struct serial_struct serial;
+
+    if (ioctl (ptc_grp->fd, TIOCGSERIAL, &serial) < 0)
+        return  false;
+
+    if (serial.flags & ASYNC_LOW_LATENCY)
+        return  true;
+
+    serial.flags |= ASYNC_LOW_LATENCY;
+    if (ioctl (ptc_grp->fd, TIOCSSERIAL, &serial) < 0) {
+        err ("TIOCSSERIAL error! (%s)\n", strerror(errno));
+        return  false;
+    }
+    return  true;
+}
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
@@ -16,58 +16,191 @@
 //------------------------------------------------------------------------------
 #include <errno.h>      // Error integer and strerror() function
 #include <fcntl.h>      // Contains file controls like O_RDWR
+#include <poll.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>        // readv(), writev()
 #include <termios.h>    // Contains POSIX terminal control definitions
 #include <unistd.h>     // write(), read(), close()
 
 #include "../typedefs.h"
 //------------------------------------------------------------------------------
+/* queue size must be a power of two (index = pos & mask) */
 #define DEFAULT_QUEUE_SIZE      1024
 
+//------------------------------------------------------------------------------
+// single-producer / single-consumer ring buffer.
+// sp, ep are free running positions. only the consumer writes sp (release),
+// only the producer writes ep (release), each side reads the other (acquire).
 //------------------------------------------------------------------------------
 typedef struct queue__t {
-    __u32   sp;
-    __u32   ep;
+    _Atomic __u32   sp;
+    _Atomic __u32   ep;
     __u32   size;
+    __u32   mask;
     __u8    *buf;
+    /* bytes dropped because the queue was full, max fill level */
+    _Atomic __u32   overflow;
+    _Atomic __u32   hwm;
+    /* eventfd signaled on queue_put to wake the consumer (-1 : not used) */
+    int     evt_fd;
 }   queue_t;
 
+//------------------------------------------------------------------------------
+// protocol rx buffer : contiguous (linear) buffer, no ring wrap inside a frame.
+// p_sp : start of the frame window(head byte), p_ep : end of received data.
+//------------------------------------------------------------------------------
 typedef struct protocol_variable__t {
 	__u32	p_sp;
 	__u32	p_ep;
 	__u32	size;
+	__u32	buf_size;
 	bool	open;
-	bool	pass;
 	__u8	*buf;
+	/* protocol private data (malloc, freed by ptc_grp_close) */
+	void	*priv;
 }   ptc_var_t;
 
+/* complete frame view (valid until the next ptc_feed) */
+typedef struct protocol_frame__t {
+    const __u8  *data;
+    __u32       len;
+}   ptc_frame_t;
+
+//------------------------------------------------------------------------------
+// pcheck : frame window at buf[p_sp] (buf[p_sp] == head)
+//          return > 0 frame length, 0 need more data, < 0 not a frame (resync)
+// pcatch : return 1 if the checked frame is accepted.
+//------------------------------------------------------------------------------
 typedef struct protocol_function__t {
     ptc_var_t   var;
+    __u8        head;
     int         (*pcheck)(ptc_var_t *p);
     int         (*pcatch)(ptc_var_t *p);
+    /* frame counters of ptc_frame_get (ptc_stats_t) */
+    __u32       frame_good, frame_bad, resync;
 }   ptc_func_t;
 
+/* epoll user data of the io reactor (uart fd or tx eventfd of a group) */
+enum eIO_EVENT {
+    IO_EVENT_UART = 0,
+    IO_EVENT_TX,
+};
+
+typedef struct io_event__t {
+    struct protocol_group__t    *grp;
+    int                         type;
+}   io_event_t;
+
+//------------------------------------------------------------------------------
+// transport : byte stream under a protocol group (uart, tcp, pty).
+// open    : set ptc_grp->fd (non-blocking), return fd or -1
+// read    : > 0 bytes, 0 or -1 with EAGAIN no data, -1 error (link lost)
+// write   : > 0 bytes, -1 with EAGAIN not ready, -1 error
+// poll    : fd watched by the io reactor
+//------------------------------------------------------------------------------
+struct protocol_group__t;
+
+typedef struct transport__t {
+    const char  *name;
+    int         (*open)  (struct protocol_group__t *ptc_grp, const char *addr, int param);
+    ssize_t     (*read)  (struct protocol_group__t *ptc_grp, const struct iovec *iov, int iov_cnt);
+    ssize_t     (*write) (struct protocol_group__t *ptc_grp, const struct iovec *iov, int iov_cnt);
+    void        (*close) (struct protocol_group__t *ptc_grp);
+    int         (*poll)  (struct protocol_group__t *ptc_grp);
+}   transport_t;
+
 typedef struct protocol_group__t {
     int         fd;
+    /* transport of fd and its private data */
+    const transport_t   *tp;
+    void        *tp_priv;
     __u8        pcnt;
 	ptc_func_t  *p;
-    pthread_t   rx_thread, tx_thread;
     queue_t     tx_q, rx_q;
+
+    /* io reactor registration, tx_wait : EPOLLOUT armed on a full uart fifo */
+    io_event_t  ev_uart, ev_tx;
+    bool        tx_wait;
+    /* tcp connect in progress : completed by the reactor on the first EPOLLOUT */
+    bool        connecting;
+    /* hangup / read error : fd is out of the reactor, rx_q.evt_fd is signalled */
+    _Atomic bool    link_lost;
+
+    /* current line speed (Bxxx) */
+    speed_t     baud;
+
+    /* protocol application data of the group (malloc, freed by ptc_grp_close) */
+    void        *priv;
+
+    /* link counters of the io reactor */
+    _Atomic __u32   rx_bytes, tx_bytes;
 }   ptc_grp_t;
 
 //------------------------------------------------------------------------------
+// link statistics snapshot (ptc_stats_get)
+// frame counters are kept per protocol, every protocol sees the whole stream
+// so the frames of the other protocol show up as its resync.
+// frame_bad : head byte with a broken frame (tail, crc) or rejected by pcatch
+// resync    : garbage skipped to find the next head byte
+// overrun .. brk : kernel serial counters (TIOCGICOUNT), -1 : not a uart
+//------------------------------------------------------------------------------
+#define PTC_STATS_MAX   4
+
+typedef struct ptc_stats__t {
+    __u32   rx_bytes, tx_bytes;
+    int     pcnt;
+    __u32   frame_good[PTC_STATS_MAX], frame_bad[PTC_STATS_MAX], resync[PTC_STATS_MAX];
+    __u32   rx_overflow, tx_overflow;
+    __u32   rx_hwm, tx_hwm;
+    int     overrun, buf_overrun, parity, frame, brk;
+}   ptc_stats_t;
+
+//------------------------------------------------------------------------------
+extern  bool        queue_init      (queue_t *q, __u32 size);
+extern  void        queue_free      (queue_t *q);
+extern  __u32       queue_count     (queue_t *q);
+extern  __u32       queue_space     (queue_t *q);
 extern  bool        queue_get       (queue_t *q, __u8 *d);
 extern  bool        queue_put       (queue_t *q, __u8 *d);
+extern  __u32       queue_put_n     (queue_t *q, const __u8 *d, __u32 n);
+extern  __u32       queue_get_n     (queue_t *q, __u8 *d, __u32 n);
+extern  __u32       queue_peek      (queue_t *q, __u8 *d, __u32 n);
+extern  int         queue_wr_iov    (queue_t *q, struct iovec *iov);
+extern  void        queue_wr_commit (queue_t *q, __u32 n);
+extern  int         queue_rd_iov    (queue_t *q, struct iovec *iov);
+extern  void        queue_rd_commit (queue_t *q, __u32 n);
 extern  void        ptc_set_status  (ptc_grp_t *ptc_grp, __u8 ptc_num, bool status);
-extern  void        ptc_q           (ptc_grp_t *ptc_grp, __u8 ptc_num, __u8 idata);
-extern  void        ptc_event       (ptc_grp_t *ptc_grp, __u8 idata);
-extern  bool        ptc_func_init   (ptc_grp_t *ptc_grp, __u8 ptc_num, __u8 ptc_size, 
+extern  __u32       ptc_feed        (ptc_grp_t *ptc_grp);
+extern  bool        ptc_frame_get   (ptc_grp_t *ptc_grp, __u8 ptc_num, ptc_frame_t *frame);
+extern  bool        ptc_func_init   (ptc_grp_t *ptc_grp, __u8 ptc_num, __u32 ptc_size, __u8 head,
                 int (*chk_func)(ptc_var_t *var), int (*cat_func)(ptc_var_t *var));
 extern  bool        ptc_grp_init    (ptc_grp_t *ptc_grp, __u8 ptc_count);
 extern  void        ptc_grp_close   (ptc_grp_t *ptc_grp);
+extern  bool        ptc_link_lost   (ptc_grp_t *ptc_grp);
+extern  bool        ptc_stats_get   (ptc_grp_t *ptc_grp, ptc_stats_t *stats);
+extern  void        ptc_stats_dump  (ptc_grp_t *ptc_grp, const char *name);
 //------------------------------------------------------------------------------
+extern  bool        uart_reactor_add(ptc_grp_t *ptc_grp);
+extern  void        uart_reactor_del(ptc_grp_t *ptc_grp);
+extern  ptc_grp_t   *ptc_grp_open   (const transport_t *tp, const char *addr, int param);
+extern  ptc_grp_t   *ptc_open       (const char *addr, int param);
 extern  ptc_grp_t   *uart_init      (const char *dev_name, speed_t baud);
 extern  void        uart_close      (ptc_grp_t *ptc_grp);
+extern  speed_t     uart_baud_speed (int baud_rate);
+extern  bool        uart_set_baud   (ptc_grp_t *ptc_grp, speed_t baud);
+extern  int         uart_latency_timer (const char *dev_name, int latency_ms);
+extern  bool        uart_low_latency(ptc_grp_t *ptc_grp);
+
+//------------------------------------------------------------------------------
+// transport.c
+//------------------------------------------------------------------------------
+extern  const transport_t   transport_uart;
+extern  const transport_t   transport_tcp;
+extern  const transport_t   transport_pty;
+extern  const transport_t   *transport_find (const char *addr, const char **dev);
 
 //------------------------------------------------------------------------------
 #endif  // #define __LIB_UART_H__
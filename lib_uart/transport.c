@@ -0,0 +1,354 @@
+//------------------------------------------------------------------------------
+/**
+ * @file transport.c
+ * @author charles-park (charles.park@hardkernel.com)
+ * @brief UART control library (byte stream transports of ptc_grp_t)
+ * @version 0.1
+ * @date 2022-05-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+//------------------------------------------------------------------------------
+#define _GNU_SOURCE     // posix_openpt(), ptsname()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+//------------------------------------------------------------------------------
+// Linux headers
+//------------------------------------------------------------------------------
+#include "lib_uart.h"
+
+//------------------------------------------------------------------------------
+static int      uart_open       (ptc_grp_t *ptc_grp, const char *addr, int param);
+static int      tcp_open        (ptc_grp_t *ptc_grp, const char *addr, int param);
+static ssize_t  tcp_read        (ptc_grp_t *ptc_grp, const struct iovec *iov, int iov_cnt);
+static int      pty_open        (ptc_grp_t *ptc_grp, const char *addr, int param);
+static void     pty_close       (ptc_grp_t *ptc_grp);
+static ssize_t  fd_read         (ptc_grp_t *ptc_grp, const struct iovec *iov, int iov_cnt);
+static ssize_t  fd_write        (ptc_grp_t *ptc_grp, const struct iovec *iov, int iov_cnt);
+static void     fd_close        (ptc_grp_t *ptc_grp);
+static int      fd_poll         (ptc_grp_t *ptc_grp);
+const transport_t *transport_find (const char *addr, const char **dev);
+
+//------------------------------------------------------------------------------
+const transport_t transport_uart = {
+    .name   = "uart",
+    .open   = uart_open,
+    .read   = fd_read,
+    .write  = fd_write,
+    .close  = fd_close,
+    .poll   = fd_poll,
+};
+
+const transport_t transport_tcp = {
+    .name   = "tcp",
+    .open   = tcp_open,
+    .read   = tcp_read,
+    .write  = fd_write,
+    .close  = fd_close,
+    .poll   = fd_poll,
+};
+
+const transport_t transport_pty = {
+    .name   = "pty",
+    .open   = pty_open,
+    .read   = fd_read,
+    .write  = fd_write,
+    .close  = pty_close,
+    .poll   = fd_poll,
+};
+
+//------------------------------------------------------------------------------
+// "tcp:host:port", "pty:[link path]", others are uart device nodes.
+// dev : address without the transport prefix
+//------------------------------------------------------------------------------
+const transport_t *transport_find (const char *addr, const char **dev)
+{
+    if (!strncmp (addr, "tcp:", strlen("tcp:"))) {
+        *dev = addr + strlen("tcp:");
+        return  &transport_tcp;
+    }
+    if (!strncmp (addr, "pty:", strlen("pty:"))) {
+        *dev = addr + strlen("pty:");
+        return  &transport_pty;
+    }
+    *dev = addr;
+    return  &transport_uart;
+}
+
+//------------------------------------------------------------------------------
+// fd based read/write : 0 or -1(EAGAIN) no data, -1 error
+//------------------------------------------------------------------------------
+static ssize_t fd_read (ptc_grp_t *ptc_grp, const struct iovec *iov, int iov_cnt)
+{
+    return  readv (ptc_grp->fd, iov, iov_cnt);
+}
+
+//------------------------------------------------------------------------------
+static ssize_t fd_write (ptc_grp_t *ptc_grp, const struct iovec *iov, int iov_cnt)
+{
+    return  writev (ptc_grp->fd, iov, iov_cnt);
+}
+
+//------------------------------------------------------------------------------
+static void fd_close (ptc_grp_t *ptc_grp)
+{
+    if (ptc_grp->fd > 0)
+        close (ptc_grp->fd);
+    ptc_grp->fd = -1;
+}
+
+//------------------------------------------------------------------------------
+static int fd_poll (ptc_grp_t *ptc_grp)
+{
+    return  ptc_grp->fd;
+}
+
+//------------------------------------------------------------------------------
+//   UART (param : termios speed Bxxx)
+//------------------------------------------------------------------------------
+static int uart_open (ptc_grp_t *ptc_grp, const char *dev_name, int param)
+{
+    int fd;
+    unsigned char buf;
+    speed_t baud = (speed_t)param;
+    // Create new termios struct, we call it 'tty' for convention
+    struct termios tty;
+
+    /* non-blocking : a slow uart must not stall the shared io reactor */
+    if ((fd = open(dev_name, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) {
+        printf("%s open error!\n", dev_name);
+        return -1;
+    }
+
+    // Read in existing settings, and handle any error
+    if(tcgetattr(fd, &tty) != 0) {
+        printf("Error %i from tcgetattr: %s\n", errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    tty.c_cflag &= ~PARENB; // Clear parity bit, disabling parity (most common)
+    tty.c_cflag &= ~CSTOPB; // Clear stop field, only one stop bit used in communication (most common)
+    tty.c_cflag &= ~CSIZE; // Clear all bits that set the data size
+    tty.c_cflag |= CS8; // 8 bits per byte (most common)
+    tty.c_cflag &= ~CRTSCTS; // Disable RTS/CTS hardware flow control (most common)
+    tty.c_cflag |= CREAD | CLOCAL; // Turn on READ & ignore ctrl lines (CLOCAL = 1)
+
+    tty.c_lflag &= ~ICANON;
+    tty.c_lflag &= ~ECHO; // Disable echo
+    tty.c_lflag &= ~ECHOE; // Disable erasure
+    tty.c_lflag &= ~ECHONL; // Disable new-line echo
+    tty.c_lflag &= ~ISIG; // Disable interpretation of INTR, QUIT and SUSP
+    tty.c_iflag &= ~(IXON | IXOFF | IXANY); // Turn off s/w flow ctrl
+    tty.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP|INLCR|IGNCR|ICRNL); // Disable any special handling of received bytes
+
+    tty.c_oflag &= ~OPOST; // Prevent special interpretation of output bytes (e.g. newline chars)
+    tty.c_oflag &= ~ONLCR; // Prevent conversion of newline to carriage return/line feed
+    // tty.c_oflag &= ~OXTABS; // Prevent conversion of tabs to spaces (NOT PRESENT ON LINUX)
+    // tty.c_oflag &= ~ONOEOT; // Prevent removal of C-d chars (0x004) in output (NOT PRESENT ON LINUX)
+
+    //tty.c_cc[VTIME] = 10;    // Wait for up to 1s (10 deciseconds), returning as soon as any data is received.
+    tty.c_cc[VTIME] = 0;
+    tty.c_cc[VMIN] = 0;
+
+    // Set in/out baud rate to be 115200
+    cfsetispeed(&tty, baud);
+    cfsetospeed(&tty, baud);
+
+    // Save tty settings, also checking for error
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        printf("Error %i from tcsetattr: %s\n", errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    while(read(fd, &buf, 1) > 0);    // read all if there is data in the serial rx buffer
+
+    ptc_grp->fd     = fd;
+    ptc_grp->baud   = baud;
+    return  fd;
+}
+
+//------------------------------------------------------------------------------
+//   TCP client ("host:port", param : not used)
+//   e.g. DUT link over USB gadget ethernet
+//------------------------------------------------------------------------------
+// tcp_open runs on the channel thread (link retry), nothing in it may block :
+// numeric hosts never touch the resolver, a host name is resolved once and the
+// address is cached for the reopen of a lost link.
+//------------------------------------------------------------------------------
+#define TCP_ADDR_CACHE  8
+/* SYN retries of a connect : 1 + 2 + 4 sec to an unreachable DUT */
+#define TCP_SYN_CNT     2
+
+static struct {
+    pthread_mutex_t lock;
+    int             cnt;
+    struct {
+        char                    addr[128];
+        struct sockaddr_storage sa;
+        socklen_t               len;
+    }   e[TCP_ADDR_CACHE];
+}   TcpAddr = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+//------------------------------------------------------------------------------
+static bool tcp_addr_get (const char *addr, struct sockaddr_storage *sa, socklen_t *len)
+{
+    struct addrinfo hints, *res;
+    char host[128], *port;
+    bool found = false;
+    int i;
+
+    pthread_mutex_lock (&TcpAddr.lock);
+    for (i = 0; i < TcpAddr.cnt; i++) {
+        if (!strcmp (TcpAddr.e[i].addr, addr)) {
+            memcpy (sa, &TcpAddr.e[i].sa, sizeof(*sa));
+            *len  = TcpAddr.e[i].len;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock (&TcpAddr.lock);
+    if (found)
+        return true;
+
+    memset  (host, 0x00, sizeof(host));
+    strncpy (host, addr, sizeof(host) -1);
+    if ((port = strrchr (host, ':')) == NULL) {
+        err ("%s : tcp address is host:port\n", addr);
+        return false;
+    }
+    *port++ = 0x00;
+
+    memset (&hints, 0x00, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_NUMERICHOST | AI_NUMERICSERV;
+    if (getaddrinfo (host, port, &hints, &res)) {
+        /* host name : blocking lookup, only the first open of the address */
+        hints.ai_flags = 0;
+        if (getaddrinfo (host, port, &hints, &res)) {
+            err ("%s : address lookup error!\n", addr);
+            return false;
+        }
+    }
+    memcpy (sa, res->ai_addr, res->ai_addrlen);
+    *len = res->ai_addrlen;
+    freeaddrinfo (res);
+
+    pthread_mutex_lock (&TcpAddr.lock);
+    if (TcpAddr.cnt < TCP_ADDR_CACHE) {
+        strncpy (TcpAddr.e[TcpAddr.cnt].addr, addr, sizeof(TcpAddr.e[0].addr) -1);
+        memcpy  (&TcpAddr.e[TcpAddr.cnt].sa, sa, sizeof(*sa));
+        TcpAddr.e[TcpAddr.cnt++].len = *len;
+    }
+    pthread_mutex_unlock (&TcpAddr.lock);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// non-blocking connect : EINPROGRESS is completed (SO_ERROR) by the io reactor,
+// a failed connect is reported as link lost.
+//------------------------------------------------------------------------------
+static int tcp_open (ptc_grp_t *ptc_grp, const char *addr, int param)
+{
+    struct sockaddr_storage sa;
+    socklen_t len;
+    int fd, on = 1, syn = TCP_SYN_CNT;
+
+    (void)param;
+    if (!tcp_addr_get (addr, &sa, &len))
+        return -1;
+
+    if ((fd = socket (sa.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0) {
+        err ("%s : socket error : %s\n", addr, strerror(errno));
+        return -1;
+    }
+    /* small frames : no nagle delay */
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &on,  sizeof(on));
+    setsockopt (fd, IPPROTO_TCP, TCP_SYNCNT,  &syn, sizeof(syn));
+
+    if (connect (fd, (struct sockaddr *)&sa, len)) {
+        if (errno != EINPROGRESS) {
+            err ("%s : connect error : %s\n", addr, strerror(errno));
+            close (fd);
+            return -1;
+        }
+        ptc_grp->connecting = true;
+    }
+    ptc_grp->fd = fd;
+    return  fd;
+}
+
+//------------------------------------------------------------------------------
+// peer closed (read 0) is an error, 0 of a uart read is no data.
+//------------------------------------------------------------------------------
+static ssize_t tcp_read (ptc_grp_t *ptc_grp, const struct iovec *iov, int iov_cnt)
+{
+    ssize_t ret = readv (ptc_grp->fd, iov, iov_cnt);
+
+    if (!ret) {
+        errno = ECONNRESET;
+        return -1;
+    }
+    return  ret;
+}
+
+//------------------------------------------------------------------------------
+//   Pseudo terminal (param : not used)
+//   the master side is used by ptc_grp, the slave is opened by the peer
+//   (simulator, test tool). addr is an optional symlink to the slave node.
+//------------------------------------------------------------------------------
+static int pty_open (ptc_grp_t *ptc_grp, const char *addr, int param)
+{
+    struct termios tty;
+    char *slave;
+    int fd;
+
+    (void)param;
+    if ((fd = posix_openpt (O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) {
+        err ("pty open error!\n");
+        return -1;
+    }
+    if (grantpt (fd) || unlockpt (fd) || ((slave = ptsname (fd)) == NULL)) {
+        err ("pty slave error!\n");
+        close (fd);
+        return -1;
+    }
+    /* raw byte stream, no echo */
+    if (!tcgetattr (fd, &tty)) {
+        cfmakeraw (&tty);
+        tcsetattr (fd, TCSANOW, &tty);
+    }
+    if (addr[0]) {
+        unlink (addr);
+        if (symlink (slave, addr))
+            err ("%s -> %s link error!\n", addr, slave);
+        else
+            ptc_grp->tp_priv = strdup (addr);
+    }
+    info ("pty %s%s%s\n", slave, addr[0] ? " <- " : "", addr);
+
+    ptc_grp->fd = fd;
+    return  fd;
+}
+
+//------------------------------------------------------------------------------
+static void pty_close (ptc_grp_t *ptc_grp)
+{
+    if (ptc_grp->tp_priv != NULL) {
+        unlink ((char *)ptc_grp->tp_priv);
+        free (ptc_grp->tp_priv);
+        ptc_grp->tp_priv = NULL;
+    }
+    fd_close (ptc_grp);
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -23,6 +23,14 @@
 /* protocol control 함수 */
 #include "protocol.h"
 
+static bool protocol_v2_unpack	(ptc_grp_t *puart, protocol_v2_t *v2,
+									const __u8 *frame, protocol_msg_t *msg);
+static void protocol_v2_nak		(ptc_grp_t *puart, protocol_v2_t *v2);
+static int  protocol_v2_wait	(protocol_v2_t *v2);
+static unsigned long long protocol_v2_now (void);
+static void protocol_ext_trim	(protocol_msg_t *msg);
+static bool protocol_ext_join	(ptc_grp_t *puart, protocol_msg_t *msg);
+
 //------------------------------------------------------------------------------
 //
 // https://docs.google.com/spreadsheets/d/18J4B4bqgUbMBA8XeoDkMcKPVEAeNCP2jQm5TOlgKUAo/edit#gid=744952288
@@ -30,25 +38,28 @@
 //------------------------------------------------------------------------------
 int protocol_check (ptc_var_t *var)
 {
-	/* head & tail check with protocol size */
-	if(var->buf[(var->p_sp + var->size -1) % var->size] != '#')	return 0;
-	if(var->buf[(var->p_sp               ) % var->size] != '@')	return 0;
-	return 1;
+	__u8 *frame = &var->buf[var->p_sp];
+
+	if ((var->p_ep - var->p_sp) < var->size)	return 0;
+
+	/* head & tail check with protocol size (in place, no copy) */
+	if (frame[RECV_OFS_head] != '@')	return -1;
+	if (frame[RECV_OFS_tail] != '#')	return -1;
+	return var->size;
 }
 
 //------------------------------------------------------------------------------
 int protocol_catch (ptc_var_t *var)
 {
-	int i;
-	char cmd = var->buf[(var->p_sp + 1) % var->size];
+	__u8 *frame = &var->buf[var->p_sp];
+	char cmd = frame[RECV_OFS_resp];
 
 	switch (cmd) {
 		case 'R':	case 'P':	case 'A':
 		case 'O':	case 'E':	case 'B':
-			fprintf(stdout, "<<<===== Recv from client [cmd = %c] : ", cmd);
-			for (i = 0; i < var->size; i++)
-				fprintf(stdout, "%c", var->buf[(var->p_sp + i) % var->size]);
-			fprintf(stdout, "\n");
+		case 'M':
+			fprintf(stdout, "<<<===== Recv from client [cmd = %c] : %.*s\n",
+				cmd, (int)var->size, frame);
 		return 1;
 		default :
 		break;
@@ -57,72 +68,563 @@ int protocol_catch (ptc_var_t *var)
 	return	0;
 }
 
+//------------------------------------------------------------------------------
+// field codec (no libc formatting) : string/decimal is left aligned, space padded.
+//------------------------------------------------------------------------------
+static void field_put_str (__u8 *field, int size, const char *str)
+{
+	int i;
+
+	for (i = 0; (i < size) && str[i]; i++)
+		field[i] = str[i];
+}
+
+//------------------------------------------------------------------------------
+static void field_put_int (__u8 *field, int size, int value)
+{
+	char digits[10];
+	int cnt = 0, i;
+	unsigned int v = (value < 0) ? 0 : value;
+
+	do {
+		digits[cnt++] = '0' + (v % 10);		v /= 10;
+	} while (v && (cnt < (int)sizeof(digits)));
+
+	/* most significant digits first, truncated to the field size */
+	for (i = 0; (i < size) && (i < cnt); i++)
+		field[i] = digits[cnt - 1 - i];
+}
+
+//------------------------------------------------------------------------------
+static int field_get_int (const __u8 *field, int size)
+{
+	int i = 0, value = 0;
+
+	while ((i < size) && (field[i] == ' '))
+		i++;
+	for (; (i < size) && (field[i] >= '0') && (field[i] <= '9'); i++)
+		value = value * 10 + (field[i] - '0');
+	return	value;
+}
+
+//------------------------------------------------------------------------------
+// send frame pack : frame buffer size is PROTOCOL_SEND_FRAME_SIZE (with LF/CR)
+//------------------------------------------------------------------------------
+int protocol_pack (__u8 *frame, char cmd, int uid, const char *group, const char *action)
+{
+	memset (frame, ' ', SEND_PROTOCOL_SIZE);
+
+	frame[SEND_OFS_head] = '@';
+	frame[SEND_OFS_cmd]  = cmd;
+	field_put_int (&frame[SEND_OFS_uid],   SEND_SIZE_uid,   uid);
+	field_put_str (&frame[SEND_OFS_group], SEND_SIZE_group, group);
+	field_put_str (&frame[SEND_OFS_data],  SEND_SIZE_data,  action);
+	frame[SEND_OFS_tail] = '#';
+
+	frame[SEND_PROTOCOL_SIZE    ] = '\n';
+	frame[SEND_PROTOCOL_SIZE + 1] = '\r';
+	return	PROTOCOL_SEND_FRAME_SIZE;
+}
+
+//------------------------------------------------------------------------------
+// recv frame unpack
+//	data[0] is the separator of status and data, leading spaces are removed.
+//	msg->ext is the untrimmed field, the result is trimmed by protocol_ext_join
+//	(a space on the 'M' fragment boundary is data).
+//------------------------------------------------------------------------------
+void protocol_unpack (const __u8 *frame, protocol_msg_t *msg)
+{
+	const __u8 *data = &frame[RECV_OFS_data +1];
+	int len = RECV_SIZE_data -1;
+
+	msg->resp   = frame[RECV_OFS_resp];
+	msg->uid    = field_get_int (&frame[RECV_OFS_uid], RECV_SIZE_uid);
+	msg->status = (frame[RECV_OFS_status] == '1') ? 1 : 0;
+
+	msg->ext = (const char *)data;		msg->ext_len = len;
+
+	while (len && (*data == ' ')) {
+		data++;		len--;
+	}
+	memcpy (msg->data, data, len);
+	msg->data[len] = 0x00;
+}
+
+//------------------------------------------------------------------------------
+// pre-encoded frame send (no formatting work)
+//------------------------------------------------------------------------------
+void protocol_frame_send (ptc_grp_t *puart, const __u8 *frame)
+{
+	queue_put_n (&puart->tx_q, frame, PROTOCOL_SEND_FRAME_SIZE);
+}
+
 //------------------------------------------------------------------------------
 void protocol_msg_send (ptc_grp_t *puart, char cmd, int uid, char *group, char *action)
 {
+	__u8 frame[PROTOCOL_SEND_FRAME_SIZE];
+
+	if (protocol_v2_active (puart)) {
+		protocol_v2_msg_send (puart, cmd, uid, group, action);
+		return;
+	}
+	protocol_pack (frame, cmd, uid, group, action);
+
+	fprintf(stdout, "=====>>> Send  to  client [ fd = %d] : %.*s\n",
+		puart->fd, SEND_PROTOCOL_SIZE, frame);
+
+	/* frame + LF/CR is queued at once, io reactor writes it with one syscall */
+	protocol_frame_send (puart, frame);
+}
+
+//------------------------------------------------------------------------------
+// protocol v2
+//------------------------------------------------------------------------------
+__u16 protocol_crc16 (const __u8 *data, int len)
+{
+	__u16 crc = 0xFFFF;
 	int i;
-	char s_uid[4], s_group[11], s_data[11];
-	send_protocol_u	send;
 
-	memset(&send, ' ', sizeof(send_protocol_u));
+	while (len--) {
+		crc ^= (__u16)(*data++) << 8;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	}
+	return	crc;
+}
 
-	memset (s_uid, 0x00, sizeof(s_uid));
-	sprintf (s_uid, "%d", uid);
-	strncpy(send.p.uid, s_uid, sizeof(send.p.uid));
+//------------------------------------------------------------------------------
+static unsigned long long protocol_v2_now (void)
+{
+	struct timespec ts;
 
-	memset (s_group, 0x00, sizeof(s_group));
-	sprintf (s_group, "%s", group);
-	strncpy(send.p.group, s_group, sizeof(send.p.group));
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return	(unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//------------------------------------------------------------------------------
+// partial frame : a corrupted len would hold the buffer until more data comes,
+// so the rest of the frame is waited for PROTOCOL_V2_FRAME_TIMEOUT only.
+// on expiry the head byte is dropped (resync) and the expected seq is nak'ed.
+//------------------------------------------------------------------------------
+static int protocol_v2_wait (protocol_v2_t *v2)
+{
+	unsigned long long now;
 
-	memset (s_data, 0x00, sizeof(s_data));
-	sprintf (s_data, "%s", action);
-	strncpy (send.p.data, s_data, sizeof(send.p.data));
+	if (v2 == NULL)
+		return	0;
 
-	send.p.head = '@';	send.p.tail = '#';
-	send.p.cmd  = cmd;	// cmd
+	now = protocol_v2_now ();
 
-	fprintf(stdout, "=====>>> Send  to  client [ fd = %d] : ", puart->fd);
-	for (i = 0; i < sizeof(send_protocol_u); i++) {
-		queue_put(&puart->tx_q, &send.bytes[i]);
-		fprintf(stdout, "%c", send.bytes[i]);
+	if (!v2->part_us) {
+		v2->part_us = now;
+		return	0;
 	}
-	fprintf(stdout, "\n");
+	if ((now - v2->part_us) < PROTOCOL_V2_FRAME_TIMEOUT * 1000ULL)
+		return	0;
 
-	{
-		char LF = '\n', CR = '\r';
-		queue_put(&puart->tx_q, &LF);
-		queue_put(&puart->tx_q, &CR);
+	err ("v2 partial frame timeout, resync\n");
+	v2->part_us = 0;
+	v2->nak_pending = true;
+	return	-1;
+}
+
+//------------------------------------------------------------------------------
+int protocol_v2_check (ptc_var_t *var)
+{
+	__u8 *frame = &var->buf[var->p_sp];
+	__u32 len, size;
+	protocol_v2_t *v2 = var->priv;
+
+	if ((var->p_ep - var->p_sp) < 2)	return protocol_v2_wait (v2);
+
+	len  = frame[1];
+	size = PROTOCOL_V2_HDR_SIZE + len + PROTOCOL_V2_CRC_SIZE;
+	if ((len <= PROTOCOL_V2_PAYLOAD_MAX) && ((var->p_ep - var->p_sp) < size))
+		return protocol_v2_wait (v2);
+
+	/* frame is complete or dropped */
+	if (v2 != NULL)
+		v2->part_us = 0;
+
+	if (len > PROTOCOL_V2_PAYLOAD_MAX)	return -1;
+
+	if (protocol_crc16 (&frame[1], PROTOCOL_V2_HDR_SIZE -1 + len) !=
+		((frame[size -2] << 8) | frame[size -1])) {
+		/* seq of a corrupted frame is not trusted, nak of the expected seq */
+		if (v2 != NULL)
+			v2->nak_pending = true;
+		return -1;
 	}
+	return size;
 }
 
 //------------------------------------------------------------------------------
-int protocol_msg_check (ptc_grp_t *puart, char *recv_cmd, char *recv_msg)
+int protocol_v2_catch (ptc_var_t *var)
 {
-	__u8 idata, p_cnt;
+	__u8 *frame = &var->buf[var->p_sp];
+	char type = frame[3];
 
-	/* uart data processing */
-	if (queue_get (&puart->rx_q, &idata))
-		ptc_event (puart, idata);
+	switch (type) {
+		case 'R':	case 'P':	case 'A':
+		case 'O':	case 'E':	case 'B':
+		case 'M':	case 'N':
+			dbg ("<<<===== Recv from client [v2 seq = %d, type = %c, len = %d]\n",
+				frame[2], type, frame[1]);
+		return 1;
+		default :
+		break;
+	}
+	err ("Unknown v2 type = %c\n", type);
+	return	0;
+}
+
+//------------------------------------------------------------------------------
+static int protocol_v2_slot (ptc_grp_t *puart)
+{
+	__u8 p_cnt;
 
+	if (puart == NULL)
+		return	-1;
 	for (p_cnt = 0; p_cnt < puart->pcnt; p_cnt++) {
-		if (puart->p[p_cnt].var.pass) {
-			ptc_var_t *var = &puart->p[p_cnt].var;
-			int i;
-
-			puart->p[p_cnt].var.pass = false;
-			puart->p[p_cnt].var.open = true;
-
-			/* recv cmd */
-			*recv_cmd = var->buf[(var->p_sp + 1) % var->size];
-			/* uuid(3) + group(10) + item(10) char size = 23 */
-			for (i = 0; i < 20; i++) {
-				// uuid start position is 2
-				recv_msg [i] = var->buf[(var->p_sp + 2 + i) % var->size];
-			}
+		if (puart->p[p_cnt].head == PROTOCOL_V2_HEAD)
+			return	p_cnt;
+	}
+	return	-1;
+}
+
+//------------------------------------------------------------------------------
+static protocol_v2_t *protocol_v2_get (ptc_grp_t *puart)
+{
+	int slot = protocol_v2_slot (puart);
+
+	return	(slot < 0) ? NULL : puart->p[slot].var.priv;
+}
+
+//------------------------------------------------------------------------------
+// the slot is closed until protocol_v2_enable, ascii traffic is not copied
+// to the v2 buffer (no resync count, no nak).
+//------------------------------------------------------------------------------
+bool protocol_v2_install (ptc_grp_t *puart, __u8 ptc_num)
+{
+	protocol_v2_t *v2;
+
+	if (!ptc_func_init (puart, ptc_num, PROTOCOL_V2_FRAME_MAX, PROTOCOL_V2_HEAD,
+						protocol_v2_check, protocol_v2_catch))
+		return	false;
+
+	if ((v2 = (protocol_v2_t *)malloc(sizeof(protocol_v2_t))) == NULL)
+		return	false;
+
+	memset (v2, 0x00, sizeof(protocol_v2_t));
+	puart->p[ptc_num].var.priv = v2;
+	ptc_set_status (puart, ptc_num, false);
+	return	true;
+}
+
+//------------------------------------------------------------------------------
+// v2 is used for sending and receiving after enable, seq restarts from 0 on
+// both sides. the slot is opened with an empty buffer.
+//------------------------------------------------------------------------------
+void protocol_v2_enable (ptc_grp_t *puart, bool enable)
+{
+	int slot = protocol_v2_slot (puart);
+	protocol_v2_t *v2;
+
+	if ((slot < 0) || ((v2 = puart->p[slot].var.priv) == NULL))
+		return;
+
+	v2->active  = enable;
+	v2->tx_seq  = v2->rx_seq = 0;
+	v2->nak_pending = v2->nak_sent = false;
+	v2->part_us = 0;
+
+	puart->p[slot].var.p_sp = puart->p[slot].var.p_ep = 0;
+	ptc_set_status (puart, slot, enable);
+}
+
+//------------------------------------------------------------------------------
+bool protocol_v2_active (ptc_grp_t *puart)
+{
+	protocol_v2_t *v2 = protocol_v2_get (puart);
+
+	return	(v2 != NULL) ? v2->active : false;
+}
+
+//------------------------------------------------------------------------------
+// a partial frame is waited or a nak is not answered yet,
+// the caller parses again after the frame timeout
+//------------------------------------------------------------------------------
+bool protocol_v2_pending (ptc_grp_t *puart)
+{
+	protocol_v2_t *v2 = protocol_v2_get (puart);
+
+	if ((v2 == NULL) || !v2->active)
+		return	false;
+	return	v2->part_us || (v2->nak_sent && (v2->nak_cnt < PROTOCOL_V2_NAK_RETRY));
+}
+
+//------------------------------------------------------------------------------
+// frame is built in the tx ring slot of the seq, kept for retransmit.
+//------------------------------------------------------------------------------
+void protocol_v2_frame_send (ptc_grp_t *puart, char type, const __u8 *payload, int len)
+{
+	protocol_v2_t *v2 = protocol_v2_get (puart);
+	__u8 *frame, slot;
+	__u16 crc;
+
+	if ((v2 == NULL) || (len > PROTOCOL_V2_PAYLOAD_MAX))
+		return;
+
+	slot  = v2->tx_seq & (PROTOCOL_V2_TX_RING -1);
+	frame = v2->tx_frame[slot];
+
+	frame[0] = PROTOCOL_V2_HEAD;
+	frame[1] = len;
+	frame[2] = v2->tx_seq++;
+	frame[3] = type;
+	memcpy (&frame[PROTOCOL_V2_HDR_SIZE], payload, len);
+
+	crc = protocol_crc16 (&frame[1], PROTOCOL_V2_HDR_SIZE -1 + len);
+	frame[PROTOCOL_V2_HDR_SIZE + len   ] = crc >> 8;
+	frame[PROTOCOL_V2_HDR_SIZE + len +1] = crc & 0xFF;
+
+	v2->tx_len[slot] = PROTOCOL_V2_HDR_SIZE + len + PROTOCOL_V2_CRC_SIZE;
+	queue_put_n (&puart->tx_q, frame, v2->tx_len[slot]);
+}
+
+//------------------------------------------------------------------------------
+void protocol_v2_msg_send (ptc_grp_t *puart, char cmd, int uid, const char *group, const char *action)
+{
+	__u8 payload[PROTOCOL_V2_PAYLOAD_MAX];
+	int len = 0, size;
+
+	payload[len++] = uid & 0xFF;
+	payload[len++] = (uid >> 8) & 0xFF;
+
+	size = strnlen (group, SEND_SIZE_group);
+	memcpy (&payload[len], group, size);	len += size;
+	payload[len++] = 0x00;
+
+	size = strnlen (action, SEND_SIZE_data);
+	memcpy (&payload[len], action, size);	len += size;
+	payload[len++] = 0x00;
+
+	dbg ("=====>>> Send  to  client [ fd = %d] : v2 %c, %d, %s, %s\n",
+		puart->fd, cmd, uid, group, action);
+
+	protocol_v2_frame_send (puart, cmd, payload, len);
+}
+
+//------------------------------------------------------------------------------
+// frames from seq are sent again (nak received)
+//------------------------------------------------------------------------------
+static void protocol_v2_resend (ptc_grp_t *puart, protocol_v2_t *v2, __u8 seq)
+{
+	__u8 cnt = v2->tx_seq - seq, slot;
+
+	if (cnt > PROTOCOL_V2_TX_RING) {
+		err ("v2 nak seq %d out of tx ring (tx seq %d)\n", seq, v2->tx_seq);
+		return;
+	}
+	for (; seq != v2->tx_seq; seq++) {
+		slot = seq & (PROTOCOL_V2_TX_RING -1);
+		queue_put_n (&puart->tx_q, v2->tx_frame[slot], v2->tx_len[slot]);
+	}
+}
+
+//------------------------------------------------------------------------------
+// nak of the expected seq. the same seq is nak'ed again once per frame timeout
+// (nak or the resent frame lost) up to PROTOCOL_V2_NAK_RETRY times, then the
+// watchdog recovers the link.
+//------------------------------------------------------------------------------
+static void protocol_v2_nak (ptc_grp_t *puart, protocol_v2_t *v2)
+{
+	__u8 *frame, size = PROTOCOL_V2_HDR_SIZE + 1 + PROTOCOL_V2_CRC_SIZE;
+	__u8 buf[PROTOCOL_V2_HDR_SIZE + 1 + PROTOCOL_V2_CRC_SIZE];
+	unsigned long long now = protocol_v2_now ();
+	__u16 crc;
+
+	v2->nak_pending = false;
+	if (v2->nak_sent && (v2->nak_seq == v2->rx_seq)) {
+		if (v2->nak_cnt >= PROTOCOL_V2_NAK_RETRY)
+			return;
+		if ((now - v2->nak_us) < PROTOCOL_V2_FRAME_TIMEOUT * 1000ULL)
+			return;
+	}
+	else
+		v2->nak_cnt = 0;
+
+	/* nak is not kept in the tx ring and does not use a seq */
+	frame = buf;
+	frame[0] = PROTOCOL_V2_HEAD;
+	frame[1] = 1;
+	frame[2] = 0;
+	frame[3] = 'N';
+	frame[4] = v2->rx_seq;
+	crc = protocol_crc16 (&frame[1], PROTOCOL_V2_HDR_SIZE);
+	frame[5] = crc >> 8;
+	frame[6] = crc & 0xFF;
+	queue_put_n (&puart->tx_q, frame, size);
+
+	v2->nak_sent = true;	v2->nak_seq = v2->rx_seq;
+	v2->nak_us   = now;		v2->nak_cnt++;
+	err ("v2 nak, expected seq %d (%d)\n", v2->rx_seq, v2->nak_cnt);
+	if (v2->nak_cnt >= PROTOCOL_V2_NAK_RETRY)
+		err ("v2 nak retry over, seq %d\n", v2->rx_seq);
+}
+
+//------------------------------------------------------------------------------
+// return true : msg is delivered to the handler
+//------------------------------------------------------------------------------
+static bool protocol_v2_unpack (ptc_grp_t *puart, protocol_v2_t *v2,
+									const __u8 *frame, protocol_msg_t *msg)
+{
+	const __u8 *payload = &frame[PROTOCOL_V2_HDR_SIZE];
+	int len = frame[1];
+	signed char diff;
+
+	if (frame[3] == 'N') {
+		if (len)
+			protocol_v2_resend (puart, v2, payload[0]);
+		return	false;
+	}
+
+	/* duplicate (already received) or lost frames before this one */
+	diff = (signed char)(frame[2] - v2->rx_seq);
+	if (diff < 0)
+		return	false;
+	if (diff > 0) {
+		v2->nak_pending = true;
+		return	false;
+	}
+	v2->rx_seq++;	v2->nak_sent = false;
+
+	memset (msg, 0x00, sizeof(protocol_msg_t));
+	msg->resp = frame[3];
+	if (len >= 2)
+		msg->uid = payload[0] | (payload[1] << 8);
+	if (len >= 3)
+		msg->status = payload[2] ? 1 : 0;
+	if (len > 3) {
+		msg->ext = (const char *)&payload[3];	msg->ext_len = len - 3;
+		len -= 3;
+		if (len > (int)sizeof(msg->data) -1)
+			len = sizeof(msg->data) -1;
+		memcpy (msg->data, &payload[3], len);
+	}
+	return	true;
+}
+
+//------------------------------------------------------------------------------
+// leading/trailing spaces of the whole result (field padding)
+//------------------------------------------------------------------------------
+static void protocol_ext_trim (protocol_msg_t *msg)
+{
+	while (msg->ext_len && (msg->ext[0] == ' ')) {
+		msg->ext++;		msg->ext_len--;
+	}
+	while (msg->ext_len && (msg->ext[msg->ext_len -1] == ' '))
+		msg->ext_len--;
+}
+
+//------------------------------------------------------------------------------
+// long result reassembly ('M'ore frames), return true : msg is complete
+//------------------------------------------------------------------------------
+static bool protocol_ext_join (ptc_grp_t *puart, protocol_msg_t *msg)
+{
+	protocol_ext_t *ext = puart->priv;
+	int len;
+
+	if (msg->resp != 'M') {
+		/* single frame result */
+		if ((ext == NULL) || !ext->len) {
+			protocol_ext_trim (msg);
 			return	true;
 		}
+		if (ext->uid != msg->uid) {
+			err ("ext uid mismatch %d, %d, %d bytes dropped\n",
+				ext->uid, msg->uid, ext->len);
+			ext->len = 0;
+			protocol_ext_trim (msg);
+			return	true;
+		}
+	}
+	else {
+		if ((ext == NULL) &&
+			((ext = (protocol_ext_t *)malloc(sizeof(protocol_ext_t))) != NULL)) {
+			ext->len = 0;
+			puart->priv = ext;
+		}
+		if (ext == NULL)
+			return	false;
+		/* new result */
+		if (ext->len && (ext->uid != msg->uid))
+			ext->len = 0;
+		ext->uid = msg->uid;
+	}
+
+	len = msg->ext_len;
+	if ((ext->len + len) > PROTOCOL_EXT_MAX) {
+		err ("ext uid %d overflow, %d bytes dropped\n",
+				msg->uid, ext->len + len - PROTOCOL_EXT_MAX);
+		len = PROTOCOL_EXT_MAX - ext->len;
 	}
-	return	false;
+	memcpy (&ext->buf[ext->len], msg->ext, len);
+	ext->len += len;
+
+	if (msg->resp == 'M')
+		return	false;
+
+	ext->buf[ext->len] = 0x00;
+	msg->ext = ext->buf;	msg->ext_len = ext->len;
+	protocol_ext_trim (msg);
+	return	true;
+}
+
+//------------------------------------------------------------------------------
+// all received data is processed, handler is called for every complete frame.
+// return : number of frames
+//------------------------------------------------------------------------------
+int protocol_msg_recv (ptc_grp_t *puart, protocol_msg_handler_t handler, void *arg)
+{
+	__u8 p_cnt;
+	int f_cnt = 0;
+	bool feed;
+	ptc_frame_t frame;
+	protocol_msg_t msg;
+
+	do {
+		/* uart data processing */
+		feed = ptc_feed (puart) ? true : false;
+
+		for (p_cnt = 0; p_cnt < puart->pcnt; p_cnt++) {
+			protocol_v2_t *v2 = puart->p[p_cnt].var.priv;
+
+			while (ptc_frame_get (puart, p_cnt, &frame)) {
+				if (v2 != NULL) {
+					if (!protocol_v2_unpack (puart, v2, frame.data, &msg))
+						continue;
+				}
+				else
+					protocol_unpack (frame.data, &msg);
+
+				if (!protocol_ext_join (puart, &msg))
+					continue;
+				handler (arg, &msg);
+				f_cnt++;
+
+				/* joined result is consumed */
+				if (puart->priv != NULL)
+					((protocol_ext_t *)puart->priv)->len = 0;
+			}
+			/* new error or the last nak not answered */
+			if ((v2 != NULL) && v2->active && (v2->nak_pending || v2->nak_sent))
+				protocol_v2_nak (puart, v2);
+		}
+	/* the reactor may have received more data while the frames were handled */
+	} while (feed);
+
+	return	f_cnt;
 }
 
 //------------------------------------------------------------------------------
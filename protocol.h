@@ -15,73 +15,178 @@
 
 #include "typedefs.h"
 
+//------------------------------------------------------------------------------
+// protocol frame layout table : F(field name, field size)
+//
+//	command description:
+//		server to client : 'C'ommand, 'R'eady(boot)
+//		                   'L'oad plan step, 'G'o (run loaded plan, uid = step count)
+//		                   'S'peed (group = new baud rate, client answers 'A' uid 0
+//		                   at the new rate, both ends fall back to 115200 on timeout)
+//		client to server : 'O'kay, 'A'ck, 'R'eady(boot), 'E'rror, 'B'usy
+//		                   'M'ore (continuation of a long result, see below)
+//
+//	client capabilities are advertised in the data field of the 'R'eady frame
+//		"PLAN" : client accepts 'L'/'G' plan download and streams the results
+//		"BAUD" : client accepts 'S' baud rate change
+//		"V2"   : client accepts binary protocol v2 (server 'A' BOOT data "V2")
+//
+//	head : '@' start protocol signal, tail : '#' end protocol signal
+//	data : msg no, msg group, msg data1, msg data2, ...
 //------------------------------------------------------------------------------
 /* Data send to Client : protocol size is 32 bytes */
+#define	SEND_PROTOCOL_FIELDS(F)	\
+	F(head,		 1)	\
+	F(cmd,		 1)	\
+	F(uid,		 3)	\
+	F(group,	10)	\
+	F(data,		10)	\
+	F(reserved,	 6)	\
+	F(tail,		 1)
+
+/* Data receive from Client : protocol size is 32 bytes */
+#define	RECV_PROTOCOL_FIELDS(F)	\
+	F(head,		 1)	\
+	F(resp,		 1)	\
+	F(uid,		 3)	\
+	F(status,	 1)	\
+	F(data,		16)	\
+	F(reserved,	 9)	\
+	F(tail,		 1)
+
+//------------------------------------------------------------------------------
+// struct, field offset(xxx_OFS_name) and field size(xxx_SIZE_name) from the table
 //------------------------------------------------------------------------------
-#pragma packet(1)
+#define	PROTOCOL_FIELD_MEMBER(name, size)	__s8	name[size];
+#define	SEND_FIELD_OFS(name, size)	SEND_OFS_##name, SEND_END_##name = SEND_OFS_##name + (size) -1,
+#define	RECV_FIELD_OFS(name, size)	RECV_OFS_##name, RECV_END_##name = RECV_OFS_##name + (size) -1,
+#define	SEND_FIELD_SIZE(name, size)	SEND_SIZE_##name = (size),
+#define	RECV_FIELD_SIZE(name, size)	RECV_SIZE_##name = (size),
+
 typedef struct send_protocol__t {
-	/* @ : start protocol signal */
-	__s8	head;
-
-	/*
-		command description:
-			server to client : 'C'ommand, 'R'eady(boot)
-			client to server : 'O'kay, 'A'ck, 'R'eady(boot), 'E'rror, 'B'usy
-	*/
-	__s8	cmd;
-	__s8	uid[3];
-	__s8	group[10];
-	/* msg no, msg group, msg data1, msg data2, ... */
-	__s8	data[10];
-
-	__s8	reserved[6];
-	/* # : end protocol signal */
-	__s8	tail;
+	SEND_PROTOCOL_FIELDS(PROTOCOL_FIELD_MEMBER)
 }	send_protocol_t;
 
-#pragma packet(1)
 typedef union send_protocol__u {
 	send_protocol_t 	p;
 	__u8				bytes[sizeof(send_protocol_t)];
 }	send_protocol_u;
 
-//------------------------------------------------------------------------------
-/* Data receive from Client : protocol size is 32 bytes */
-#pragma packet(1)
 typedef struct recv_protocol__t {
-	/* @ : start protocol signal */
-	__s8	head;
-
-	/*
-		command description:
-			server to client : 'C'ommand, 'R'eady(boot)
-			client to server : 'O'kay, 'A'ck, 'R'eady(boot), 'E'rror, 'B'usy
-	*/
-	__s8	resp;
-	__s8	uid[3];
-	__s8	status;
-
-	/* msg no, msg group, msg data1, msg data2, ... */
-	__s8	data[16];
-
-	__s8	reserved[9];
-	/* # : end protocol signal */
-	__s8	tail;
+	RECV_PROTOCOL_FIELDS(PROTOCOL_FIELD_MEMBER)
 }	recv_protocol_t;
 
-#pragma packet(1)
 typedef union recv_protocol__u {
 	recv_protocol_t 	p;
 	__u8				bytes[sizeof(recv_protocol_t)];
 }	recv_protocol_u;
 
+enum { SEND_PROTOCOL_FIELDS(SEND_FIELD_OFS)  SEND_PROTOCOL_SIZE };
+enum { RECV_PROTOCOL_FIELDS(RECV_FIELD_OFS)  RECV_PROTOCOL_SIZE };
+enum { SEND_PROTOCOL_FIELDS(SEND_FIELD_SIZE) };
+enum { RECV_PROTOCOL_FIELDS(RECV_FIELD_SIZE) };
+
+_Static_assert (sizeof(send_protocol_t) == SEND_PROTOCOL_SIZE, "send protocol size");
+_Static_assert (sizeof(recv_protocol_t) == RECV_PROTOCOL_SIZE, "recv protocol size");
+
+/* send frame on the wire : protocol + LF + CR */
+#define	PROTOCOL_SEND_FRAME_SIZE	(SEND_PROTOCOL_SIZE + 2)
+
+//------------------------------------------------------------------------------
+/* received message (unpacked recv protocol) */
+typedef struct protocol_msg__t {
+	char	resp;
+	int		uid;
+	int		status;
+	/* data field without the separator and leading spaces */
+	char	data[RECV_SIZE_data];
+	/* whole result data (not null terminated) */
+	const char	*ext;
+	int			ext_len;
+}	protocol_msg_t;
+
+/* called for every received frame (msg->resp : 'R','P','A','O','E','B') */
+typedef void (*protocol_msg_handler_t) (void *arg, protocol_msg_t *msg);
+
+//------------------------------------------------------------------------------
+// long result : the client sends the result in 'M'ore frames with the same uid
+// followed by the final response frame ('O','E','A'). the data of the 'M' frames
+// (ascii : 15 bytes of data field, v2 : payload data) and the final frame is
+// joined, msg->ext/ext_len of the final frame points to the whole result
+// (leading/trailing spaces of the result are trimmed, not of each frame).
+// a result of one frame points into the frame (no copy), both are valid only
+// in the handler call.
+//------------------------------------------------------------------------------
+#define	PROTOCOL_EXT_MAX		1024
+
+typedef struct protocol_ext__t {
+	int		uid;
+	int		len;
+	char	buf[PROTOCOL_EXT_MAX +1];
+}	protocol_ext_t;
+
+//------------------------------------------------------------------------------
+// protocol v2 (binary, negotiated with "V2" in the 'R'eady frame data)
+//
+//	frame : head(0xA5) | len | seq | type | payload[len] | crc16(hi) | crc16(lo)
+//	crc16 : CCITT (poly 0x1021, init 0xFFFF) of len .. payload
+//	type  : command/response char of the ascii protocol, 'N'ak
+//
+//	server to client payload : uid(lo, hi), group, 0x00, action, 0x00
+//	client to server payload : uid(lo, hi), status, data
+//	'N'ak payload : seq, frames from seq are sent again (from the tx ring)
+//
+//	a frame with a crc error or a seq gap is answered with a 'N'ak of the
+//	expected seq, so a corrupted frame costs one frame time to recover.
+//------------------------------------------------------------------------------
+#define	PROTOCOL_V2_HEAD		0xA5
+#define	PROTOCOL_V2_HDR_SIZE	4
+#define	PROTOCOL_V2_CRC_SIZE	2
+#define	PROTOCOL_V2_PAYLOAD_MAX	64
+#define	PROTOCOL_V2_FRAME_MAX	(PROTOCOL_V2_HDR_SIZE + PROTOCOL_V2_PAYLOAD_MAX + PROTOCOL_V2_CRC_SIZE)
+/* sent frames kept for retransmit, power of 2 */
+#define	PROTOCOL_V2_TX_RING		16
+/* partial frame deadline (ms) : max frame at 115200 + usb latency timer */
+#define	PROTOCOL_V2_FRAME_TIMEOUT	50
+/* nak of the same seq is repeated every frame timeout, up to this count */
+#define	PROTOCOL_V2_NAK_RETRY	8
+
+typedef struct protocol_v2__t {
+	/* v2 frames are used for sending */
+	bool	active;
+	/* next seq to send, next seq expected */
+	__u8	tx_seq, rx_seq;
+	/* crc error detected (ptc check) / seq of the last nak sent */
+	bool	nak_pending, nak_sent;
+	__u8	nak_seq, nak_cnt;
+	/* last nak sent (us) */
+	unsigned long long	nak_us;
+	/* partial frame at the buffer head is waited from (us), 0 : none */
+	unsigned long long	part_us;
+
+	__u8	tx_len[PROTOCOL_V2_TX_RING];
+	__u8	tx_frame[PROTOCOL_V2_TX_RING][PROTOCOL_V2_FRAME_MAX];
+}	protocol_v2_t;
+
 //------------------------------------------------------------------------------
 // function prototype define
 //------------------------------------------------------------------------------
 extern	int 	protocol_catch		(ptc_var_t *var);
 extern	int 	protocol_check		(ptc_var_t *var);
+extern	int 	protocol_pack		(__u8 *frame, char cmd, int uid, const char *group, const char *action);
+extern	void 	protocol_unpack		(const __u8 *frame, protocol_msg_t *msg);
+extern	void 	protocol_frame_send	(ptc_grp_t *puart, const __u8 *frame);
 extern	void 	protocol_msg_send	(ptc_grp_t *puart, char cmd, int uid, char *group, char *action);
-extern	int 	protocol_msg_check 	(ptc_grp_t *puart, char *recv_cmd, char *recv_msg);
+extern	int 	protocol_msg_recv 	(ptc_grp_t *puart, protocol_msg_handler_t handler, void *arg);
+extern	__u16	protocol_crc16		(const __u8 *data, int len);
+extern	int 	protocol_v2_check	(ptc_var_t *var);
+extern	int 	protocol_v2_catch	(ptc_var_t *var);
+extern	bool	protocol_v2_install	(ptc_grp_t *puart, __u8 ptc_num);
+extern	void	protocol_v2_enable	(ptc_grp_t *puart, bool enable);
+extern	bool	protocol_v2_active	(ptc_grp_t *puart);
+extern	bool	protocol_v2_pending	(ptc_grp_t *puart);
+extern	void	protocol_v2_frame_send	(ptc_grp_t *puart, char type, const __u8 *payload, int len);
+extern	void	protocol_v2_msg_send	(ptc_grp_t *puart, char cmd, int uid, const char *group, const char *action);
 
 //------------------------------------------------------------------------------
 #endif	// #define	__PROTOCOL_H__
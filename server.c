@@ -12,6 +12,7 @@
 //------------------------------------------------------------------------------
 // for my lib
 //------------------------------------------------------------------------------
+#define _GNU_SOURCE     // pthread_tryjoin_np()
 /* 많이 사용되는 define 정의 모음 */
 #include "typedefs.h"
 #include "common.h"
@@ -19,37 +20,286 @@
 #include "./lib_ui/lib_ui.h"
 #include "./lib_uart/lib_uart.h"
 #include "./lib_adc/lib_adc.h"
+#include "./lib_sim/lib_sim.h"
 
 #include "protocol.h"
 #include "server.h"
 
+//------------------------------------------------------------------------------
+/* SIGUSR1 : channel link statistics dump request (kill -USR1 pid) */
+static volatile sig_atomic_t StatsDumpReq = 0;
+/* main loop wakeup of the signal handler (ui queue eventfd) */
+static int StatsWakeFd = -1;
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void find_uart_dev (struct server_t *pserver, int channel)
 {
+	DIR *dir;
+	struct dirent *entry;
+	char path[PATH_MAX], rpath[PATH_MAX];
+	channel_t *pchannel = &pserver->channel[channel];
+
+	/* /sys/class/tty/ttyUSBx/device -> /sys/devices/.../{usb_port}/ttyUSBx */
+	if ((dir = opendir (FIND_UART_NODE_BASE)) == NULL) {
+		err ("%s open error! (%s)\n", FIND_UART_NODE_BASE, strerror(errno));
+		return;
+	}
+	while ((entry = readdir (dir)) != NULL) {
+		if (strncmp (entry->d_name, "ttyUSB", strlen("ttyUSB")))
+			continue;
 
-	FILE *fp;
-	char rdata[256], *ptr;
+		snprintf (path, sizeof(path), "%s/%s/device", FIND_UART_NODE_BASE, entry->d_name);
+		if (realpath (path, rpath) == NULL)
+			continue;
 
-	memset  (rdata, 0x00, sizeof(rdata));
-	sprintf (rdata, "find %s/ -name ttyUSB* 2<&1", FIND_UART_NODE_BASE);
-
-	// UART (ttyUSB) find...
-	if ((fp = popen(rdata, "r")) != NULL) {
-		memset (rdata, 0x00, sizeof(rdata));
-		while (fgets (rdata, sizeof(rdata), fp) != NULL) {
-			if ((ptr = strstr (rdata, pserver->channel[channel].usb_port)) != NULL) {
-				if ((ptr = strstr (rdata, "ttyUSB")) != NULL) {
-					pserver->channel[channel].is_available = true;
-					sprintf (pserver->channel[channel].dev_uart_name, "/dev/ttyUSB%c", *(ptr + 6));
-					pclose(fp);
-					return;
-				}
+		if (strstr (rpath, pchannel->usb_port) != NULL) {
+			/* d_name is up to 255 bytes : a truncated node name is not opened */
+			if (snprintf (pchannel->dev_uart_name, sizeof(pchannel->dev_uart_name),
+						"/dev/%s", entry->d_name) >= (int)sizeof(pchannel->dev_uart_name)) {
+				err ("/dev/%s : node name too long, skipped\n", entry->d_name);
+				pchannel->dev_uart_name[0] = 0x00;
+				continue;
 			}
-			memset (rdata, 0x00, sizeof(rdata));
+			pchannel->is_available = true;
+			/* rx latency timer of the usb-serial adapter */
+			pchannel->latency_timer =
+				uart_latency_timer (pchannel->dev_uart_name, pserver->uart_latency);
+			break;
 		}
-		pclose(fp);
 	}
+	closedir (dir);
+}
+
+//------------------------------------------------------------------------------
+// channel link : SERVER_CHANNEL tcp: / pty: address if defined, else the usb uart node
+//------------------------------------------------------------------------------
+void find_link_dev (struct server_t *pserver, int channel)
+{
+	channel_t *pchannel = &pserver->channel[channel];
+
+	pchannel->latency_timer = -1;
+	if (pchannel->link[0]) {
+		sprintf (pchannel->dev_uart_name, "%s", pchannel->link);
+		pchannel->is_available = true;
+		return;
+	}
+	find_uart_dev (pserver, channel);
+}
+
+//------------------------------------------------------------------------------
+// SERVER_CHANNEL line : false if a field is missing
+//------------------------------------------------------------------------------
+bool channel_parse (channel_t *pchannel, char *cmd_line)
+{
+	char *ptr;
+
+	if ((ptr = strtok (cmd_line, ", ")) == NULL)	return false;
+	strncpy (pchannel->name, ptr, sizeof(pchannel->name) -1);
+
+	if ((ptr = strtok (NULL, ", ")) == NULL)	return false;
+	/* link address (tcp:host:port, pty:link) instead of the usb uart */
+	if (!strncmp (ptr, "tcp:", strlen("tcp:")) || !strncmp (ptr, "pty:", strlen("pty:")))
+		strncpy (pchannel->link, ptr, sizeof(pchannel->link) -1);
+	else
+		strncpy (pchannel->usb_port, ptr, sizeof(pchannel->usb_port) -1);
+
+	if ((ptr = strtok (NULL, ", ")) == NULL)	return false;
+	strncpy (pchannel->dev_i2c_name, ptr, sizeof(pchannel->dev_i2c_name) -1);
+
+	if ((ptr = strtok (NULL, ", ")) == NULL)	return false;
+	pchannel->ui_group = atoi(ptr);
+
+	if ((ptr = strtok (NULL, ", ")) == NULL)	return false;
+	pchannel->finish_r_item = atoi(ptr);
+
+	if ((ptr = strtok (NULL, ", ")) == NULL)	return false;
+	pchannel->status_r_item = atoi(ptr);
+
+	return true;
+}
+
+//------------------------------------------------------------------------------
+// SERVER_CHANNEL = name, usb port | link, i2c port, ui group, finish ritem, status ritem
+// no SERVER_CHANNEL line : left / right channel of the default defines
+//------------------------------------------------------------------------------
+void channel_load (struct server_t *pserver)
+{
+	char cmd_line[CMD_CHAR_MAX];
+	char cmds[CMD_CHAR_MAX * CHANNEL_MAX];
+	channel_t *pchannel;
+	int i, ch;
+
+	if ((pserver->channel = calloc (CHANNEL_MAX, sizeof(channel_t))) == NULL) {
+		err ("SYSTEM Initialize fail(CHANNEL)\n");
+		exit(0);
+	}
+
+	memset (cmds, 0x00, sizeof(cmds));
+	find_appcfg_data ("SERVER_CHANNEL", cmds, CHANNEL_MAX);
+
+	for (i = 0, ch = 0; i < CHANNEL_MAX; i++) {
+		memset (cmd_line, 0x00, sizeof(cmd_line));
+		memcpy (cmd_line, &cmds[i * CMD_CHAR_MAX], sizeof(cmd_line));
+		if (cmd_line[0] == 0x00)
+			break;
+
+		pchannel = &pserver->channel[ch];
+		if (!channel_parse (pchannel, cmd_line)) {
+			err ("SERVER_CHANNEL line %d : missing field, ignored\n", i +1);
+			memset (pchannel, 0x00, sizeof(channel_t));
+			continue;
+		}
+		ch++;
+	}
+	pserver->ch_count = ch;
+
+	if (!pserver->ch_count) {
+		pserver->ch_count = CHANNEL_DEFAULT_COUNT;
+		for (ch = 0; ch < pserver->ch_count; ch++) {
+			pchannel = &pserver->channel[ch];
+			sprintf (pchannel->name, "%s", ch ? "right" : "left");
+			sprintf (pchannel->usb_port, "%s",
+					ch ? SERVER_UART_R_USB_PORT : SERVER_UART_L_USB_PORT);
+			sprintf (pchannel->dev_i2c_name, "%s",
+					ch ? SERVER_I2C_R_PORT : SERVER_I2C_L_PORT);
+			pchannel->ui_group		= ch +1;
+			pchannel->finish_r_item	= ch ? FINISH_DISPLAY_R_ITEM_R : FINISH_DISPLAY_R_ITEM_L;
+			pchannel->status_r_item	= ch ? STATUS_R_UART_R_ITEM : STATUS_L_UART_R_ITEM;
+		}
+	}
+
+	for (ch = 0; ch < pserver->ch_count; ch++) {
+		pchannel = &pserver->channel[ch];
+		info ("CHANNEL %d, %6s, %s, %s, ui group %d, finish %d, status %d\n",
+			ch, pchannel->name,
+			pchannel->link[0] ? pchannel->link : pchannel->usb_port,
+			pchannel->dev_i2c_name, pchannel->ui_group,
+			pchannel->finish_r_item, pchannel->status_r_item);
+	}
+}
+
+//------------------------------------------------------------------------------
+// SERVER_CMD = uid of each channel(ch_count), group, action, ...
+//------------------------------------------------------------------------------
+int resource_find (struct server_t *pserver, const char *name)
+{
+	int i;
+
+	for (i = 0; i < pserver->res_count; i++)
+		if (!strcasecmp (pserver->res[i].name, name))
+			return i;
+	return -1;
+}
+
+//------------------------------------------------------------------------------
+// SERVER_RESOURCE = name, limit (ADC, CLIENT are always defined)
+//------------------------------------------------------------------------------
+void resource_load (struct server_t *pserver)
+{
+	char cmd_line[CMD_CHAR_MAX], *ptr;
+	char cmds[CMD_CHAR_MAX * RESOURCE_MAX];
+	resource_t *pres;
+	int i, pos;
+
+	/* always defined, a SERVER_RESOURCE line only changes the limit */
+	pres = &pserver->res[pserver->res_count++];
+	sprintf (pres->name, "%s", RESOURCE_ADC);
+	pres->limit = 1;
+
+	pres = &pserver->res[pserver->res_count++];
+	sprintf (pres->name, "%s", RESOURCE_CLIENT);
+	pres->limit = pserver->cmd_window;
+
+	memset (cmds, 0x00, sizeof(cmds));
+	find_appcfg_data ("SERVER_RESOURCE", cmds, RESOURCE_MAX);
+
+	for (i = 0; i < RESOURCE_MAX; i++) {
+		memset (cmd_line, 0x00, sizeof(cmd_line));
+		memcpy (cmd_line, &cmds[i * CMD_CHAR_MAX], sizeof(cmd_line));
+		if (cmd_line[0] == 0x00)
+			break;
+
+		if ((ptr = strtok (cmd_line, ", ")) == NULL)	continue;
+		if ((pos = resource_find (pserver, ptr)) < 0) {
+			if (pserver->res_count >= RESOURCE_MAX) {
+				err ("SERVER_RESOURCE %s : over RESOURCE_MAX(%d), ignored\n",
+					ptr, RESOURCE_MAX);
+				continue;
+			}
+			pos = pserver->res_count++;
+		}
+		pres = &pserver->res[pos];
+		strncpy (pres->name, toupperstr (ptr), sizeof(pres->name) -1);
+
+		/* SERVER_RESOURCE lines : the plan is scheduled as a DAG */
+		pserver->plan_dag = true;
+
+		if ((ptr = strtok (NULL, ", ")) == NULL)	continue;
+		pres->limit = atoi(ptr);
+	}
+	for (i = 0; i < pserver->res_count; i++) {
+		if (pserver->res[i].limit < 1)
+			pserver->res[i].limit = 1;
+		info ("SERVER_RESOURCE %02d, %10s, limit %d\n", i +1,
+			pserver->res[i].name, pserver->res[i].limit);
+	}
+}
+
+//------------------------------------------------------------------------------
+// step name of the dep: annotation : GROUP-ACTION
+//------------------------------------------------------------------------------
+int cmd_name_find (struct server_t *pserver, const char *name)
+{
+	char cmd_name[sizeof(pserver->cmds[0].group) + sizeof(pserver->cmds[0].action) +1];
+	int i;
+
+	for (i = 0; i < pserver->cmd_count; i++) {
+		snprintf (cmd_name, sizeof(cmd_name), "%s-%s",
+					pserver->cmds[i].group, pserver->cmds[i].action);
+		if (!strcasecmp (cmd_name, name))
+			return i;
+	}
+	return -1;
+}
+
+//------------------------------------------------------------------------------
+// topological order of the plan (Kahn), false : dependency cycle.
+// cp_len : longest chain of steps from the step to the end of the plan.
+//------------------------------------------------------------------------------
+bool cmd_dag_build (struct server_t *pserver)
+{
+	int indeg[CMD_COUNT_MAX], order[CMD_COUNT_MAX];
+	int cnt = 0, head = 0, i, j, k;
+
+	for (i = 0; i < pserver->cmd_count; i++) {
+		indeg[i] = pserver->cmds[i].dep_count;
+		pserver->cmds[i].cp_len = 1;
+		if (!indeg[i])
+			order[cnt++] = i;
+	}
+	while (head < cnt) {
+		int done = order[head++];
+
+		for (j = 0; j < pserver->cmd_count; j++)
+			for (k = 0; k < pserver->cmds[j].dep_count; k++)
+				if ((pserver->cmds[j].dep[k] == done) && !--indeg[j])
+					order[cnt++] = j;
+	}
+	if (cnt != pserver->cmd_count)
+		return false;
+
+	/* reverse order : the successors of a step are already known */
+	for (i = cnt -1; i >= 0; i--) {
+		cmd_t *pcmd = &pserver->cmds[order[i]];
+
+		for (k = 0; k < pcmd->dep_count; k++) {
+			cmd_t *pdep = &pserver->cmds[pcmd->dep[k]];
+			if (pdep->cp_len < pcmd->cp_len +1)
+				pdep->cp_len = pcmd->cp_len +1;
+		}
+	}
+	return true;
 }
 
 //------------------------------------------------------------------------------
@@ -57,9 +307,14 @@ void server_cmd_load (struct server_t *pserver)
 {
 	char cmd_line[CMD_CHAR_MAX], *ptr;
 	char cmds[CMD_CHAR_MAX * CMD_COUNT_MAX];
+	/* dep: / res: annotation, resolved after all steps are loaded */
+	char deps[CMD_COUNT_MAX][CMD_ANNOT_SIZE], ress[CMD_COUNT_MAX][CMD_ANNOT_SIZE];
+
+	memset (deps, 0x00, sizeof(deps));
+	memset (ress, 0x00, sizeof(ress));
 
 	memset (cmds, 0x00, sizeof(cmds));
-	find_appcfg_data ("SERVER_CMD",  cmds);
+	find_appcfg_data ("SERVER_CMD",  cmds, CMD_COUNT_MAX);
 
 	for (	pserver->cmd_count = 0;
 			pserver->cmd_count < CMD_COUNT_MAX;
@@ -69,13 +324,15 @@ void server_cmd_load (struct server_t *pserver)
 		memcpy (cmd_line, &cmds[pserver->cmd_count * CMD_CHAR_MAX], sizeof(cmd_line));
 
 		if (cmd_line[0] != 0x00) {
-			ptr = strtok (cmd_line, ",");
-			if (ptr == NULL)	continue;
-			pserver->cmds[pserver->cmd_count].uid[0] = atoi(ptr);
-			
-			ptr = strtok (NULL, ",");
-			if (ptr == NULL)	continue;
-			pserver->cmds[pserver->cmd_count].uid[1] = atoi(ptr);
+			int ch;
+
+			for (ch = 0, ptr = cmd_line; ch < pserver->ch_count; ch++) {
+				ptr = strtok (ptr, ",");
+				if (ptr == NULL)	break;
+				pserver->cmds[pserver->cmd_count].uid[ch] = atoi(ptr);
+				ptr = NULL;
+			}
+			if (ch != pserver->ch_count)	continue;
 
 			ptr = toupperstr (strtok (NULL, ","));
 			if (ptr == NULL)	continue;
@@ -110,20 +367,89 @@ void server_cmd_load (struct server_t *pserver)
 				if (ptr == NULL)	continue;
 				pserver->cmds[pserver->cmd_count].min = atoi(ptr);
 			}
+			/* DAG plan : dep:GROUP-ACTION[+GROUP-ACTION..], res:NAME[+NAME] */
+			while ((ptr = strtok (NULL, ", \t\r")) != NULL) {
+				if      (!strncasecmp (ptr, "dep:", strlen("dep:")))
+					strncpy (deps[pserver->cmd_count], ptr + strlen("dep:"),
+								CMD_ANNOT_SIZE -1);
+				else if (!strncasecmp (ptr, "res:", strlen("res:")))
+					strncpy (ress[pserver->cmd_count], ptr + strlen("res:"),
+								CMD_ANNOT_SIZE -1);
+				else
+					err ("CMD %02d : unknown annotation %s\n", pserver->cmd_count +1, ptr);
+			}
 		}
 		else	break;
 	}
 
 	{
-		int i;
+		int i, pos;
+		for (i = 0; i < pserver->cmd_count; i++) {
+			cmd_t *pcmd = &pserver->cmds[i];
+
+			if (deps[i][0] || ress[i][0])
+				pserver->plan_dag = true;
+
+			for (ptr = strtok (deps[i], "+"); ptr != NULL; ptr = strtok (NULL, "+")) {
+				if (((pos = cmd_name_find (pserver, ptr)) < 0) || (pos == i) ||
+					(pcmd->dep_count >= CMD_DEP_MAX)) {
+					err ("CMD %02d : dep %s ignored\n", i +1, ptr);
+					continue;
+				}
+				pcmd->dep[pcmd->dep_count++] = pos;
+			}
+			for (ptr = strtok (ress[i], "+"); ptr != NULL; ptr = strtok (NULL, "+")) {
+				if (((pos = resource_find (pserver, ptr)) < 0) ||
+					(pcmd->res_count >= CMD_RES_MAX)) {
+					err ("CMD %02d : res %s ignored\n", i +1, ptr);
+					continue;
+				}
+				pcmd->res[pcmd->res_count++] = pos;
+			}
+			/* default : adc measurement or client test */
+			if (!pcmd->res_count)
+				pcmd->res[pcmd->res_count++] =
+					resource_find (pserver, pcmd->is_adc ? RESOURCE_ADC : RESOURCE_CLIENT);
+		}
+		if (pserver->plan_dag && !cmd_dag_build (pserver)) {
+			err ("SERVER_CMD dependency cycle, the plan runs in file order\n");
+			pserver->plan_dag = false;
+		}
+	}
+
+	{
+		int i, ch;
+		char uid_str[CHANNEL_MAX * 4 +1];
 		for (i = 0; i < pserver->cmd_count; i++) {
-			info ("CMD %02d, %03d %03d %10s %10s %d %d %d %10s %04d %04d\n",
+			/* command frames are encoded once and replayed by cmd_sned_control */
+			memset (uid_str, 0x00, sizeof(uid_str));
+			for (ch = 0; ch < pserver->ch_count; ch++) {
+				protocol_pack (pserver->cmds[i].frame[ch], 'C',
+								pserver->cmds[i].uid[ch],
+								pserver->cmds[i].group,
+								pserver->cmds[i].action);
+				sprintf (&uid_str[ch * 4], "%03d ", pserver->cmds[i].uid[ch] % 1000);
+			}
+
+			info ("CMD %02d, %s%10s %10s %d %d %d %10s %04d %04d\n",
 				i +1,
-				pserver->cmds[i].uid[0], pserver->cmds[i].uid[1], 
+				uid_str, 
 				pserver->cmds[i].group, pserver->cmds[i].action, 
 				pserver->cmds[i].is_info, pserver->cmds[i].is_str, 
 				pserver->cmds[i].is_adc, pserver->cmds[i].adc_name, 
 				pserver->cmds[i].max, pserver->cmds[i].min);
+			if (pserver->plan_dag) {
+				char dag_str[CMD_ANNOT_SIZE];
+				int k, len;
+
+				memset (dag_str, 0x00, sizeof(dag_str));
+				for (k = 0, len = 0; k < pserver->cmds[i].dep_count; k++)
+					len += snprintf (&dag_str[len], sizeof(dag_str) - len, "%02d ",
+									pserver->cmds[i].dep[k] +1);
+				info ("\tcp %d, res %s, dep %s\n", pserver->cmds[i].cp_len,
+					pserver->res[pserver->cmds[i].res[0]].name,
+					pserver->cmds[i].dep_count ? dag_str : "-");
+			}
 		}
 	}
 }
@@ -135,7 +461,7 @@ void power_pin_load (struct server_t *pserver)
 	char cmds[CMD_CHAR_MAX * CMD_COUNT_MAX];
 
 	memset (cmds, 0x00, sizeof(cmds));
-	find_appcfg_data ("POWER_PIN",  cmds);
+	find_appcfg_data ("POWER_PIN",  cmds, POWER_PINS_MAX);
 
 	for (	pserver->power_pin_count = 0;
 			pserver->power_pin_count < POWER_PINS_MAX;
@@ -175,51 +501,80 @@ void power_pin_load (struct server_t *pserver)
 void app_cfg_load (struct server_t *pserver)
 {
 	char int_str[8];
-	if (find_appcfg_data ("SERVER_FB_DEVICE",     pserver->fb_dev))
+	if (find_appcfg_data ("SERVER_FB_DEVICE",     pserver->fb_dev, 1))
 		sprintf (pserver->fb_dev,    "%s", SERVER_FB_DEVICE);
-	if (find_appcfg_data ("SERVER_UI_CONFIG",     pserver->ui_config))
+	if (find_appcfg_data ("SERVER_UI_CONFIG",     pserver->ui_config, 1))
 		sprintf (pserver->ui_config, "%s", SERVER_UI_CONFIG);
 
-	if (find_appcfg_data ("SERVER_UART_L_USB_PORT", pserver->channel[CH_L].usb_port))
-		sprintf (pserver->channel[CH_L].usb_port,  "%s", SERVER_UART_L_USB_PORT);
-	if (find_appcfg_data ("SERVER_UART_R_USB_PORT", pserver->channel[CH_R].usb_port))
-		sprintf (pserver->channel[CH_R].usb_port,  "%s", SERVER_UART_R_USB_PORT);
+	/* simulator : enable, latency(ms), drop, busy, garbage, error (per 1000 responses) */
+	{
+		char sim_str[CMD_CHAR_MAX], *ptr;
+		int i;
 
-	if (find_appcfg_data ("SERVER_I2C_L_PORT", pserver->channel[CH_L].dev_i2c_name))
-		sprintf (pserver->channel[CH_L].dev_i2c_name, "%s", SERVER_I2C_L_PORT);
-	if (find_appcfg_data ("SERVER_I2C_R_PORT", pserver->channel[CH_R].dev_i2c_name))
-		sprintf (pserver->channel[CH_R].dev_i2c_name, "%s", SERVER_I2C_R_PORT);
+		memset (sim_str, 0x00, sizeof(sim_str));
+		if (!find_appcfg_data ("SERVER_SIMULATOR", sim_str, 1)) {
+			ptr = strtok (sim_str, ",");
+			pserver->sim_enable = ((ptr != NULL) && atoi(ptr)) ? true : false;
+			for (i = 0; i < 5; i++) {
+				if ((ptr = strtok (NULL, ",")) == NULL)
+					break;
+				pserver->sim_cfg[i] = atoi(ptr);
+			}
+		}
+	}
 
 	memset (int_str, 0x00, sizeof(int_str));
-	if (find_appcfg_data ("ALIVE_DISPLAY_R_ITEM", int_str))
-		pserver->alive_r_item = ALIVE_DISPLAY_R_ITEM;
+	if (find_appcfg_data ("CMD_PIPELINE_WINDOW", int_str, 1))
+		pserver->cmd_window = CMD_WINDOW_DEFAULT;
 	else
-		pserver->alive_r_item = atoi(int_str);
-	
+		pserver->cmd_window = atoi(int_str);
+	if ((pserver->cmd_window < 1) || (pserver->cmd_window > CMD_WINDOW_MAX))
+		pserver->cmd_window = CMD_WINDOW_DEFAULT;
+
 	memset (int_str, 0x00, sizeof(int_str));
-	if (find_appcfg_data ("FINISH_DISPLAY_R_ITEM_L", int_str))
-		pserver->channel[CH_L].finish_r_item = FINISH_DISPLAY_R_ITEM_L;
+	if (find_appcfg_data ("SERVER_PLAN_DOWNLOAD", int_str, 1))
+		pserver->plan_download = false;
 	else
-		pserver->channel[CH_L].finish_r_item = atoi(int_str);
+		pserver->plan_download = atoi(int_str) ? true : false;
 
 	memset (int_str, 0x00, sizeof(int_str));
-	if (find_appcfg_data ("FINISH_DISPLAY_R_ITEM_R", int_str))
-		pserver->channel[CH_R].finish_r_item = FINISH_DISPLAY_R_ITEM_R;
+	if (find_appcfg_data ("SERVER_UART_BAUD", int_str, 1))
+		pserver->uart_baud = SERVER_UART_BAUD;
 	else
-		pserver->channel[CH_R].finish_r_item = atoi(int_str);
+		pserver->uart_baud = atoi(int_str);
+	if (!uart_baud_speed (pserver->uart_baud))
+		pserver->uart_baud = SERVER_UART_BAUD;
 
+	memset (int_str, 0x00, sizeof(int_str));
+	if (find_appcfg_data ("SERVER_UART_LATENCY", int_str, 1))
+		pserver->uart_latency = SERVER_UART_LATENCY;
+	else
+		pserver->uart_latency = atoi(int_str);
+
+	memset (int_str, 0x00, sizeof(int_str));
+	if (find_appcfg_data ("SERVER_PROTOCOL_V2", int_str, 1))
+		pserver->protocol_v2 = false;
+	else
+		pserver->protocol_v2 = atoi(int_str) ? true : false;
+
+	memset (int_str, 0x00, sizeof(int_str));
+	if (find_appcfg_data ("ALIVE_DISPLAY_R_ITEM", int_str, 1))
+		pserver->alive_r_item = ALIVE_DISPLAY_R_ITEM;
+	else
+		pserver->alive_r_item = atoi(int_str);
+	
 	// net printer app check
 #define	NLP_DISPLAY_R_ITEM	27
 	memset (int_str, 0x00, sizeof(int_str));
-	if (find_appcfg_data ("NLP_DISPLAY_R_ITEM", int_str))
+	if (find_appcfg_data ("NLP_DISPLAY_R_ITEM", int_str, 1))
 		pserver->nlp_r_item = NLP_DISPLAY_R_ITEM;
 	else
 		pserver->nlp_r_item = atoi(int_str);
 
-	if (!find_appcfg_data ("NLP_APP_PATH", pserver->nlp_path)) {
+	if (!find_appcfg_data ("NLP_APP_PATH", pserver->nlp_path, 1)) {
 		if (access (pserver->nlp_path, R_OK) == 0) {
 			pserver->nlp_app = true;
-			if (find_appcfg_data ("NLP_IP_ADDR", pserver->nlp_ip)) {
+			if (find_appcfg_data ("NLP_IP_ADDR", pserver->nlp_ip, 1)) {
 				sprintf (pserver->nlp_ip, "%s", "AUTO SERACH");
 				pserver->nlp_auto = true;
 			}
@@ -229,7 +584,7 @@ void app_cfg_load (struct server_t *pserver)
 				memset (model_name, 0x00, sizeof(model_name));
 
 				pserver->nlp_zd230d = false;
-				if (!find_appcfg_data ("NLP_MODEL", model_name)) {
+				if (!find_appcfg_data ("NLP_MODEL", model_name, 1)) {
 					if (!strncmp ("ZD230D", model_name, strlen("ZD230D")-1))
 						pserver->nlp_zd230d = true;
 				}
@@ -245,34 +600,184 @@ void app_cfg_load (struct server_t *pserver)
 void app_protocol_install (struct server_t *pserver)
 {
 	int i = 0;
-	for (i = 0; i < CH_END; i++) {
-		if (pserver->channel[i].is_available) {
-			pserver->channel[i].puart = uart_init (pserver->channel[i].dev_uart_name, B115200);
-			if (pserver->channel[i].puart) {
-				if (ptc_grp_init (pserver->channel[i].puart, 1)) {
-					if (!ptc_func_init (pserver->channel[i].puart, 0, sizeof(recv_protocol_u),
-											protocol_check, protocol_catch)) {
-						err ("UART %s protocol install fail\n", pserver->channel[i].dev_uart_name);
-					} else {
-						info ("UART %s protocol install success.\n", pserver->channel[i].dev_uart_name);
-						protocol_msg_send (pserver->channel[i].puart, 'P', 1, "REBOOT", "-");
-					}
-				}
-			}
-			else
-				pserver->channel[i].is_available = false;
-		}
+	for (i = 0; i < pserver->ch_count; i++) {
+		if (pserver->channel[i].is_available)
+			channel_attach (pserver, i);
+
 		/* UI Channel state display */
-		if (!pserver->channel[i].is_available || !pserver->channel[i].fd_i2c) {
-			char err_msg[30], ritem;
-			memset (err_msg, 0x00, sizeof(err_msg));
-			ritem = i ? STATUS_R_UART_R_ITEM : STATUS_L_UART_R_ITEM;
+		if (!pserver->channel[i].is_available || !pserver->channel[i].fd_i2c)
+			channel_status_display (pserver, i);
+	}
+}
+
+//------------------------------------------------------------------------------
+// open the channel link and install the ascii & binary v2 protocol
+//------------------------------------------------------------------------------
+bool channel_attach (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+
+	pchannel->puart = ptc_open (pchannel->dev_uart_name, B115200);
+	if (pchannel->puart == NULL) {
+		pchannel->is_available = false;
+		return false;
+	}
+	pchannel->is_available = true;
+
+	if ((pserver->uart_latency >= 0) &&
+		strstr (pchannel->dev_uart_name, "ttyUSB") &&
+		!uart_low_latency (pchannel->puart))
+		err ("UART %s low latency mode fail\n", pchannel->dev_uart_name);
+
+	/* ascii protocol & binary protocol v2 (SERVER_PROTOCOL_V2) */
+	if (ptc_grp_init (pchannel->puart, pserver->protocol_v2 ? 2 : 1)) {
+		if (!ptc_func_init (pchannel->puart, 0, sizeof(recv_protocol_u),
+								'@', protocol_check, protocol_catch) ||
+			(pserver->protocol_v2 && !protocol_v2_install (pchannel->puart, 1))) {
+			err ("UART %s protocol install fail\n", pchannel->dev_uart_name);
+		} else {
+			info ("UART %s protocol install success.\n", pchannel->dev_uart_name);
+			protocol_msg_send (pchannel->puart, 'P', 1, "REBOOT", "-");
+		}
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------------
+// usb uart removed or link lost : close the link, the test in progress is stopped.
+// the other channel is not touched.
+//------------------------------------------------------------------------------
+void channel_detach (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+
+	if (pchannel->puart != NULL) {
+		uart_close (pchannel->puart);
+		pchannel->puart = NULL;
+	}
+	pchannel->is_available = false;
+
+	if (pchannel->cmd_pos && (pchannel->cmd_pos != pserver->cmd_count)) {
+		ui_post_sitem (pserver, pchannel->finish_r_item, COLOR_WHITE, -1, "STOP");
+		ui_post_ritem (pserver, pchannel->finish_r_item, COLOR_RED, -1);
+	}
+	channel_cmd_reset (pserver, ch);
+	pchannel->baud_check = false;
+	pchannel->client_caps = 0;
+	pchannel->is_connect = 0;	pchannel->watchdog_cnt = 0;
+	/* re-attach starts from the power check */
+	pchannel->state = SYSTEM_INIT;
+}
+
+//------------------------------------------------------------------------------
+void channel_status_display (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+	char err_msg[64], ritem;
+
+	ritem = pchannel->status_r_item;
+	if (!pchannel->is_available || !pchannel->fd_i2c) {
+		memset (err_msg, 0x00, sizeof(err_msg));
+
+		ui_post_ritem (pserver, ritem,	COLOR_RED, -1);
+		sprintf (err_msg, "%s : UART %d, I2C %d",
+			pchannel->name,
+			pchannel->is_available, pchannel->fd_i2c);
+		ui_post_sitem (pserver, ritem, -1, -1, err_msg);
+	} else {
+		/* re-attached : ui.cfg default */
+		sprintf (err_msg, "%s CHANNEL", pchannel->name);
+		ui_post_ritem (pserver, ritem, pserver->pui->bc.uint, -1);
+		ui_post_sitem (pserver, ritem, -1, -1, toupperstr (err_msg));
+	}
+}
 
-			ui_set_ritem (pserver->pfb, pserver->pui, ritem,	COLOR_RED, -1);
-			sprintf (err_msg, "%s : UART %d, I2C %d",
-				i ? "CH_R" : "CH_L",
-				pserver->channel[i].is_available, pserver->channel[i].fd_i2c);
-			ui_set_sitem (pserver->pfb, pserver->pui, ritem, -1, -1, err_msg);
+//------------------------------------------------------------------------------
+// kernel uevent (NETLINK_KOBJECT_UEVENT) : usb uart add / remove
+//------------------------------------------------------------------------------
+void app_hotplug_init (struct server_t *pserver)
+{
+	struct sockaddr_nl addr;
+	int fd;
+
+	pserver->uevent_fd = -1;
+	if ((fd = socket (AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+						NETLINK_KOBJECT_UEVENT)) < 0) {
+		err ("uevent socket error! (%s)\n", strerror(errno));
+		return;
+	}
+	memset (&addr, 0x00, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid    = 0;
+	addr.nl_groups = 1;		/* kernel uevent group */
+
+	if (bind (fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		err ("uevent bind error! (%s)\n", strerror(errno));
+		close (fd);
+		return;
+	}
+	pserver->uevent_fd = fd;
+}
+
+//------------------------------------------------------------------------------
+// uevent : "action@devpath\0KEY=value\0KEY=value\0..."
+// tty ttyUSBx of a configured usb port : add -> attach, remove -> detach
+//------------------------------------------------------------------------------
+void uart_hotplug_check (struct server_t *pserver)
+{
+	char buf[UEVENT_BUF_SIZE], *ptr;
+	const char *action, *devpath, *subsystem, *devname;
+	ssize_t len;
+	int ch;
+
+	if (pserver->uevent_fd < 0)
+		return;
+
+	while ((len = recv (pserver->uevent_fd, buf, sizeof(buf) -1, 0)) > 0) {
+		buf[len] = 0x00;
+		action = devpath = subsystem = devname = NULL;
+
+		for (ptr = buf; ptr < buf + len; ptr += strlen(ptr) + 1) {
+			if      (!strncmp (ptr, "ACTION=",    strlen("ACTION=")))
+				action    = ptr + strlen("ACTION=");
+			else if (!strncmp (ptr, "DEVPATH=",   strlen("DEVPATH=")))
+				devpath   = ptr + strlen("DEVPATH=");
+			else if (!strncmp (ptr, "SUBSYSTEM=", strlen("SUBSYSTEM=")))
+				subsystem = ptr + strlen("SUBSYSTEM=");
+			else if (!strncmp (ptr, "DEVNAME=",   strlen("DEVNAME=")))
+				devname   = ptr + strlen("DEVNAME=");
+		}
+		if (!action || !devpath || !subsystem || !devname ||
+			strcmp (subsystem, "tty") || strncmp (devname, "ttyUSB", strlen("ttyUSB")))
+			continue;
+
+		for (ch = 0; ch < pserver->ch_count; ch++) {
+			channel_t *pchannel = &pserver->channel[ch];
+
+			/* tcp: / pty: link channels are not usb uart */
+			if (pchannel->link[0] || !pchannel->usb_port[0] ||
+				(strstr (devpath, pchannel->usb_port) == NULL))
+				continue;
+
+			ui_channel_lock (pserver, ch);
+			if (!strcmp (action, "add") && !pchannel->is_available) {
+				snprintf (pchannel->dev_uart_name, sizeof(pchannel->dev_uart_name),
+							"/dev/%s", devname);
+				pchannel->latency_timer =
+					uart_latency_timer (pchannel->dev_uart_name, pserver->uart_latency);
+				info ("%s : %s attach\n", pchannel->name, pchannel->dev_uart_name);
+				if (!channel_attach (pserver, ch))
+					err ("%s : %s open fail\n", pchannel->name, pchannel->dev_uart_name);
+				channel_status_display (pserver, ch);
+				channel_wakeup (pserver, ch);
+			}
+			if (!strcmp (action, "remove") && pchannel->is_available) {
+				info ("%s : %s detach\n", pchannel->name, pchannel->dev_uart_name);
+				channel_detach (pserver, ch);
+				channel_status_display (pserver, ch);
+				channel_wakeup (pserver, ch);
+			}
+			pthread_mutex_unlock (&pchannel->lock);
 		}
 	}
 }
@@ -284,9 +789,12 @@ int app_init (struct server_t *pserver)
 	info ("[ %s : %s ]\n", __FILE__, __func__);
 
 	memset (pserver, 0x00, sizeof(struct server_t));
+	pserver->uevent_fd = -1;
 
 	// APP config data read
 	app_cfg_load    (pserver);
+	channel_load    (pserver);
+	resource_load   (pserver);
 	server_cmd_load (pserver);
 	power_pin_load  (pserver);
 
@@ -299,122 +807,277 @@ int app_init (struct server_t *pserver)
 	info ("SERVER_FB_DEVICE        = %s\n", pserver->fb_dev);
 	info ("SERVER_UI_CONFIG        = %s\n", pserver->ui_config);
 	info ("ALIVE_DISPLAY_R_ITEM    = %d\n", pserver->alive_r_item);
-	info ("FINISH_DISPLAY_R_ITEM_L = %d\n", pserver->channel[CH_L].finish_r_item);
-	info ("FINISH_DISPLAY_R_ITEM_R = %d\n", pserver->channel[CH_R].finish_r_item);
-	info ("SERVER_UART_L_USB_PORT  = %s\n", pserver->channel[CH_L].usb_port);
-	info ("SERVER_UART_R_USB_PORT  = %s\n", pserver->channel[CH_R].usb_port);
-
-	pserver->channel[CH_L].fd_i2c = adc_board_init (pserver->channel[CH_L].dev_i2c_name);
-	info ("SERVER_I2C_L_PORT       = %s\n", pserver->channel[CH_L].dev_i2c_name);
-	info ("SERVER_I2C_L_PORT_FD    = %d\n", pserver->channel[CH_L].fd_i2c);
-	pserver->channel[CH_R].fd_i2c = adc_board_init (pserver->channel[CH_R].dev_i2c_name);
-	info ("SERVER_I2C_R_PORT       = %s\n", pserver->channel[CH_R].dev_i2c_name);
-	info ("SERVER_I2C_R_PORT_FD    = %d\n", pserver->channel[CH_R].fd_i2c);
-
-	find_uart_dev (pserver, CH_L);
-	info ("SERVER_UART_L_DEVICE   = %s\n", pserver->channel[CH_L].dev_uart_name);
-	find_uart_dev (pserver, CH_R);
-	info ("SERVER_UART_R_DEVICE   = %s\n", pserver->channel[CH_R].dev_uart_name);
+	info ("CMD_PIPELINE_WINDOW     = %d\n", pserver->cmd_window);
+	info ("SERVER_PLAN_DOWNLOAD    = %d\n", pserver->plan_download);
+	info ("SERVER_UART_BAUD        = %d\n", pserver->uart_baud);
+	info ("SERVER_UART_LATENCY     = %d\n", pserver->uart_latency);
+	info ("SERVER_PROTOCOL_V2      = %d\n", pserver->protocol_v2);
+	info ("SERVER_PLAN_DAG         = %d\n", pserver->plan_dag);
+
+	if (pserver->sim_enable) {
+		/* pty client simulator instead of the uart / adc board */
+		app_sim_init (pserver);
+	} else {
+		int ch;
+		for (ch = 0; ch < pserver->ch_count; ch++) {
+			pserver->channel[ch].fd_i2c = adc_board_init (pserver->channel[ch].dev_i2c_name);
+			find_link_dev (pserver, ch);
+		}
+	}
+	{
+		int ch;
+		for (ch = 0; ch < pserver->ch_count; ch++)
+			info ("CHANNEL %d, %6s : I2C %s (fd %d), UART %s\n", ch,
+				pserver->channel[ch].name,
+				pserver->channel[ch].dev_i2c_name, pserver->channel[ch].fd_i2c,
+				pserver->channel[ch].dev_uart_name);
+	}
 
 	pserver->pfb	= fb_init 	(pserver->fb_dev);
+	/* simulator : memory framebuffer if there is no display */
+	if ((pserver->pfb == NULL) && (pserver->psim != NULL))
+		pserver->pfb = sim_fb_init (SIM_FB_WIDTH, SIM_FB_HEIGHT);
 	pserver->pui	= ui_init	(pserver->pfb, pserver->ui_config) ;
+	if ((pserver->pui == NULL) && (pserver->psim != NULL))
+		pserver->pui = ui_init (pserver->pfb, "ui.cfg");
 	if ((pserver->pfb == NULL) || (pserver->pui == NULL)) {
 		err ("SYSTEM Initialize fail(FB/UI)\n");
 		exit(0);
 	}
+	if (!msg_queue_init (&pserver->ui_q,  UI_QUEUE_SIZE,  sizeof(ui_msg_t)) ||
+		!msg_queue_init (&pserver->nlp_q, NLP_QUEUE_SIZE, sizeof(nlp_msg_t))) {
+		err ("SYSTEM Initialize fail(QUEUE)\n");
+		exit(0);
+	}
+	StatsWakeFd = pserver->ui_q.evt_fd;
 	// UART Protocol Inatsll & Channel state UI display
 	app_protocol_install (pserver);
 
+	if (pserver->psim != NULL)
+		app_sim_start (pserver);
+	else
+		app_hotplug_init (pserver);
+
+	signal (SIGUSR1, app_stats_signal);
+
 	info ("---------------------------------\n");
 	return 0;
 }
 
 //------------------------------------------------------------------------------
-void app_exit (struct server_t *pserver)
+// simulator : channel uart is the slave of a pty pair, the adc board is faked.
+//------------------------------------------------------------------------------
+void app_sim_init (struct server_t *pserver)
 {
-	{
-		int i;
-		for (i = 0; i < CH_END; i++)
-		uart_close(pserver->channel[i].puart);
+	int ch;
+
+	pserver->psim = sim_init (pserver->ch_count, pserver->sim_cfg[0], pserver->sim_cfg[1],
+								pserver->sim_cfg[2], pserver->sim_cfg[3], pserver->sim_cfg[4]);
+	if (pserver->psim == NULL) {
+		err ("SYSTEM Initialize fail(SIMULATOR)\n");
+		exit(0);
+	}
+	info ("SERVER_SIMULATOR        = latency %d ms, drop %d, busy %d, garbage %d, error %d\n",
+		pserver->sim_cfg[0], pserver->sim_cfg[1], pserver->sim_cfg[2], pserver->sim_cfg[3],
+		pserver->sim_cfg[4]);
+
+	for (ch = 0; ch < pserver->ch_count; ch++) {
+		sprintf (pserver->channel[ch].dev_uart_name, "%s", sim_dev_name (pserver->psim, ch));
+		pserver->channel[ch].is_available = true;
+		pserver->channel[ch].latency_timer = -1;
+		/* not a real i2c fd, adc is read from the simulator */
+		pserver->channel[ch].fd_i2c = -1;
 	}
-	ui_close  (pserver->pui);
-	fb_clear  (pserver->pfb);
-	fb_close  (pserver->pfb);
 }
 
 //------------------------------------------------------------------------------
-void power_pins_check (struct server_t *pserver)
+// simulated client answers : adc commands leave the value in the check range,
+// header patterns follow the pattern number of the action (PATTERN_n).
+//------------------------------------------------------------------------------
+void app_sim_start (struct server_t *pserver)
 {
-	int ch;
-	static struct timeval t;
+	int ch, i, pin, values[SIM_ADC_PINS];
 
-	if (!run_interval_check(&t, POWER_CHECK_INTERVAL))
-		return;
-
-	for (ch = 0; ch < CH_END; ch ++) {
+	for (ch = 0; ch < pserver->ch_count; ch++) {
+		for (i = 0; i < pserver->power_pin_count; i++) {
+			values[0] = (pserver->power_pins[i].v_max + pserver->power_pins[i].v_min) / 2;
+			sim_adc_set (pserver->psim, ch, pserver->power_pins[i].adc_name, values, 1);
+		}
+		for (i = 0; i < pserver->cmd_count; i++) {
+			cmd_t *pcmd = &pserver->cmds[i];
 
-		int values[40], cnt, err_cnt, i;
-		for (i = 0, err_cnt = 0; i < pserver->power_pin_count; i++) {
-			
-			if (!pserver->channel[ch].fd_i2c) {
-				err_cnt++;
+			if (!pcmd->is_adc) {
+				sim_cmd_add (pserver->psim, ch, pcmd->uid[ch], "SIM", NULL, NULL, 0);
 				continue;
 			}
-
-			adc_read_pin (pserver->channel[ch].fd_i2c,
-				pserver->power_pins[i].adc_name, &values[0], &cnt);
-
-			if ((values[0] > pserver->power_pins[i].v_max) ||
-				(values[0] < pserver->power_pins[i].v_min)) {
-				err_cnt++;
-				err ("ch %d, %d > max %d or %d < min %d",
-					ch,
-					values[0], pserver->power_pins[i].v_max,
-					values[0], pserver->power_pins[i].v_min);
+			if (!strncmp (pcmd->group, "HEADER", sizeof("HEADER"))) {
+				char pattern = pcmd->action[strlen(pcmd->action) -1];
+				char data[2] = { pattern, 0 };
+
+				for (pin = 0; pin < SIM_ADC_PINS; pin++)
+					values[pin] = Patterns[(pattern - '0') & 0x3][pin] ? pcmd->max : pcmd->min;
+				sim_cmd_add (pserver->psim, ch, pcmd->uid[ch], data,
+								pcmd->adc_name, values, SIM_ADC_PINS);
+			} else {
+				values[0] = (pcmd->max + pcmd->min) / 2;
+				sim_cmd_add (pserver->psim, ch, pcmd->uid[ch], "SIM",
+								pcmd->adc_name, values, 1);
 			}
 		}
-		pserver->channel[ch].power_status = err_cnt ? false : true;
 	}
+	sim_start (pserver->psim);
 }
 
 //------------------------------------------------------------------------------
-void system_watchdog (struct server_t *pserver)
+bool channel_adc_read (struct server_t *pserver, char ch, const char *name,
+						int *values, int *cnt)
 {
-	static struct timeval t;
-	char ch;
-	static int resp_wait = 0;
-
-	if (!run_interval_check(&t, WATCHDOG_CHECK_INTERVAL))
-		return;
+	if (pserver->psim != NULL)
+		return	sim_adc_read (pserver->psim, ch, name,
+							(unsigned int *)values, (unsigned int *)cnt);
 
-	for (ch = 0; ch < CH_END; ch++) {
-		if (!pserver->channel[ch].power_status)
-			continue;
-		if (!pserver->channel[ch].is_available)
-			continue;
-		if (pserver->channel[ch].state == SYSTEM_ERROR)
-			continue;
-		pserver->channel[ch].watchdog_cnt++;
-	}
+	return	adc_read_pin (pserver->channel[ch].fd_i2c, name,
+							(unsigned int *)values, (unsigned int *)cnt);
 }
 
 //------------------------------------------------------------------------------
-void nlp_error_print_page (struct server_t *pserver, char ch, const char *pstr)
+void app_stats_signal (int signo)
 {
-	FILE *fp;
+	(void)signo;
+	StatsDumpReq = 1;
+	if (StatsWakeFd >= 0)
+		eventfd_write (StatsWakeFd, 1);
+}
+
+//------------------------------------------------------------------------------
+// link statistics of each channel : tells a bad cable (line errors, bad
+// frames, resync) from a slow client (rtt, queue high-watermark).
+//------------------------------------------------------------------------------
+void server_stats_dump (struct server_t *pserver)
+{
+	int ch;
+
+	if (!StatsDumpReq)
+		return;
+	StatsDumpReq = 0;
+
+	for (ch = 0; ch < pserver->ch_count; ch++) {
+		channel_t *pchannel = &pserver->channel[ch];
+
+		ui_channel_lock (pserver, ch);
+		if (!pchannel->is_available || (pchannel->puart == NULL))
+			info ("%s : not available\n", pchannel->name);
+		else {
+			ptc_stats_dump  (pchannel->puart, pchannel->dev_uart_name);
+			channel_rtt_dump (pserver, ch);
+		}
+		pthread_mutex_unlock (&pchannel->lock);
+	}
+}
+
+//------------------------------------------------------------------------------
+void app_exit (struct server_t *pserver)
+{
+	if (pserver->running) {
+		int i;
+		pserver->running = false;
+		for (i = 0; i < pserver->ch_count; i++) {
+			channel_t *pchannel = &pserver->channel[i];
+
+			channel_wakeup (pserver, i);
+			/* the worker may wait on a full ui_q : drained until it exits */
+			while (pthread_tryjoin_np (pchannel->thread, NULL) == EBUSY) {
+				ui_queue_flush (pserver);
+				usleep (1000);
+			}
+			pthread_mutex_destroy (&pchannel->lock);
+			close (pchannel->tick_tfd);
+			close (pchannel->wake_fd);		close (pchannel->epfd);
+		}
+		/* printer job in progress is not waited */
+		pthread_detach (pserver->nlp_thread);
+	}
+	{
+		int i;
+		for (i = 0; i < pserver->ch_count; i++)
+			if (pserver->channel[i].puart != NULL)
+				uart_close(pserver->channel[i].puart);
+	}
+	if (pserver->uevent_fd >= 0)
+		close (pserver->uevent_fd);
+	if (pserver->tick_tfd > 0)
+		close (pserver->tick_tfd);
+	if (pserver->epfd > 0)
+		close (pserver->epfd);
+	free (pserver->channel);
+	ui_queue_flush  (pserver);
+	msg_queue_close (&pserver->ui_q);
+	ui_close  (pserver->pui);
+	fb_clear  (pserver->pfb);
+	fb_close  (pserver->pfb);
+}
+
+//------------------------------------------------------------------------------
+void power_pins_check (struct server_t *pserver, char ch)
+{
+	int values[40], cnt, err_cnt, i;
+
+	for (i = 0, err_cnt = 0; i < pserver->power_pin_count; i++) {
+
+		if (!pserver->channel[ch].fd_i2c) {
+			err_cnt++;
+			continue;
+		}
+
+		channel_adc_read (pserver, ch,
+			pserver->power_pins[i].adc_name, &values[0], &cnt);
+
+		if ((values[0] > pserver->power_pins[i].v_max) ||
+			(values[0] < pserver->power_pins[i].v_min)) {
+			err_cnt++;
+			err ("ch %d, %d > max %d or %d < min %d",
+				ch,
+				values[0], pserver->power_pins[i].v_max,
+				values[0], pserver->power_pins[i].v_min);
+		}
+	}
+	pserver->channel[ch].power_status = err_cnt ? false : true;
+}
+
+//------------------------------------------------------------------------------
+void system_watchdog (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+
+	if (!pchannel->power_status)
+		return;
+	if (!pchannel->is_available)
+		return;
+	if (pchannel->state == SYSTEM_ERROR)
+		return;
+	pchannel->watchdog_cnt++;
+}
+
+//------------------------------------------------------------------------------
+// printer thread : popen of the nlp app does not hold the channel worker
+//------------------------------------------------------------------------------
+void nlp_error_print_page (struct server_t *pserver, const char *ch_name,
+							const char *pstr)
+{
+	FILE *fp;
 	char rdata[256];
 
 	memset  (rdata, 0x00, sizeof(rdata));
 	if (pserver->nlp_auto)
 		sprintf (rdata, "%s -c %s %s -t error -m %s 2<&1",
 			pserver->nlp_path,
-			ch ? "right" : "left",
+			ch_name,
 			pserver->nlp_zd230d ? "-f -z" : "-f",
 			pstr);
 	else
 		sprintf (rdata, "%s -c %s %s %s -t error -m %s 2<&1",
 			pserver->nlp_path,
-			ch ? "right" : "left",
+			ch_name,
 			pserver->nlp_zd230d ? "-z -a" : "-a",
 			pserver->nlp_ip, pstr);
 
@@ -422,6 +1085,29 @@ void nlp_error_print_page (struct server_t *pserver, char ch, const char *pstr)
 		pclose(fp);
 }
 
+//------------------------------------------------------------------------------
+void nlp_error_page_post (struct server_t *pserver, char ch, const char *pstr)
+{
+	nlp_msg_t msg;
+
+	memset (&msg, 0x00, sizeof(msg));
+	snprintf (msg.ch_name, sizeof(msg.ch_name), "%s", pserver->channel[ch].name);
+	snprintf (msg.str, sizeof(msg.str), "%s", pstr);
+	msg_queue_put (&pserver->nlp_q, &msg);
+}
+
+//------------------------------------------------------------------------------
+void *nlp_print_thread (void *arg)
+{
+	struct server_t *pserver = (struct server_t *)arg;
+	nlp_msg_t msg;
+
+	while (msg_queue_get (&pserver->nlp_q, &msg, true))
+		nlp_error_print_page (pserver, msg.ch_name, msg.str);
+
+	return NULL;
+}
+
 //------------------------------------------------------------------------------
 void nlp_error_print(struct server_t *pserver, char ch)
 {
@@ -438,7 +1124,7 @@ void nlp_error_print(struct server_t *pserver, char ch)
 					pserver->cmds[i].group,	pserver->cmds[i].action);
 
 			if ((pstr_len + err_str_len) > sizeof(pstr)) {
-				nlp_error_print_page (pserver, ch, pstr);
+				nlp_error_page_post (pserver, ch, pstr);
 				memset (pstr, 0x00, sizeof(pstr));
 				pstr_len = sprintf (pstr, "%s", err_str);
 			} else {
@@ -448,121 +1134,196 @@ void nlp_error_print(struct server_t *pserver, char ch)
 		}
 	}
 	if (pstr_len > 2)
-		nlp_error_print_page (pserver, ch, pstr);
+		nlp_error_page_post (pserver, ch, pstr);
 }
 
 //------------------------------------------------------------------------------
-void server_status_display (struct server_t *pserver)
+// ui request of the worker threads : fb / ui are drawn only by the main thread
+//------------------------------------------------------------------------------
+void ui_post_ritem (struct server_t *pserver, int id, int bc, int lc)
 {
-	static struct timeval t;
-	static int check_count = 0;
-	static bool onoff;
-	char state, ch;;
+	ui_msg_t msg;
 
-	if (!run_interval_check(&t, STATUS_CHECK_INTERVAL))
-		return;
+	memset (&msg, 0x00, sizeof(msg));
+	msg.type = UI_MSG_RITEM;	msg.id = id;	msg.bc = bc;	msg.lc = lc;
+	msg_queue_put (&pserver->ui_q, &msg);
+}
 
-	if ((check_count++ % 2) == 0)
-		onoff = !onoff;
+//------------------------------------------------------------------------------
+void ui_post_sitem (struct server_t *pserver, int id, int fc, int bc, const char *str)
+{
+	ui_msg_t msg;
 
-	for (ch = 0; ch < CH_END; ch++) {
-		channel_t *pchannel = &pserver->channel[ch];
-		/* channel enable check (UART/I2C) */
-		if (!pchannel->is_available || !pchannel->fd_i2c)
-			continue;
+	memset (&msg, 0x00, sizeof(msg));
+	msg.type = UI_MSG_SITEM;	msg.id = id;	msg.fc = fc;	msg.bc = bc;
+	/* the ui item string is cut to the queue message size */
+	snprintf (msg.str, sizeof(msg.str), "%.*s", (int)sizeof(msg.str) -1, str);
+	msg_queue_put (&pserver->ui_q, &msg);
+}
 
-		if (!pchannel->power_status)
-			state = SYSTEM_INIT;
-		else {
-			if (pchannel->watchdog_cnt > WATCHDOG_RESET_COUNT)
-					state = SYSTEM_ERROR;
-			else if (!pchannel->is_connect) {
-					state = SYSTEM_WAIT;
-			} else {
-				if (!pchannel->cmd_pos && 
-					(pchannel->state != SYSTEM_BOOT))
-					state = SYSTEM_BOOT;
-				else {
-					if ((pchannel->cmd_pos != pserver->cmd_count)) {
-						state = SYSTEM_RUNNING;
+//------------------------------------------------------------------------------
+void ui_post_update (struct server_t *pserver, int id)
+{
+	ui_msg_t msg;
+
+	memset (&msg, 0x00, sizeof(msg));
+	msg.type = UI_MSG_UPDATE;	msg.id = id;
+	msg_queue_put (&pserver->ui_q, &msg);
+}
+
+//------------------------------------------------------------------------------
+void ui_post_group (struct server_t *pserver, int gid)
+{
+	ui_msg_t msg;
+
+	memset (&msg, 0x00, sizeof(msg));
+	msg.type = UI_MSG_GROUP;	msg.id = gid;
+	msg_queue_put (&pserver->ui_q, &msg);
+}
+
+//------------------------------------------------------------------------------
+void ui_queue_flush (struct server_t *pserver)
+{
+	ui_msg_t msg;
+
+	while (msg_queue_get (&pserver->ui_q, &msg, false)) {
+		switch (msg.type) {
+			case	UI_MSG_RITEM:
+				ui_set_ritem (pserver->pfb, pserver->pui, msg.id, msg.bc, msg.lc);
+			break;
+			case	UI_MSG_SITEM:
+				ui_set_sitem (pserver->pfb, pserver->pui, msg.id, msg.fc, msg.bc, msg.str);
+			break;
+			case	UI_MSG_UPDATE:
+				ui_update (pserver->pfb, pserver->pui, msg.id);
+			break;
+			case	UI_MSG_GROUP:
+				ui_update_group (pserver->pfb, pserver->pui, msg.id);
+			break;
+			default :
+			break;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+// channel lock of the main thread (hotplug, stats) : a worker may wait on a
+// full ui_q with its lock held, so ui_q is drained while the lock is busy.
+//------------------------------------------------------------------------------
+void ui_channel_lock (struct server_t *pserver, char ch)
+{
+	while (pthread_mutex_trylock (&pserver->channel[ch].lock) == EBUSY) {
+		ui_queue_flush (pserver);
+		usleep (1000);
+	}
+}
+
+//------------------------------------------------------------------------------
+void server_status_display (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+	char state;
+
+	if ((pchannel->status_cnt++ % 2) == 0)
+		pchannel->status_onoff = !pchannel->status_onoff;
+
+	/* channel enable check (UART/I2C) */
+	if (!pchannel->is_available || !pchannel->fd_i2c)
+		return;
+
+	if (!pchannel->power_status)
+		state = SYSTEM_INIT;
+	else {
+		if (pchannel->watchdog_cnt > WATCHDOG_RESET_COUNT)
+				state = SYSTEM_ERROR;
+		else if (!pchannel->is_connect) {
+				state = SYSTEM_WAIT;
+		} else {
+			if (!pchannel->cmd_pos && 
+				(pchannel->state != SYSTEM_BOOT))
+				state = SYSTEM_BOOT;
+			else {
+				if ((pchannel->cmd_pos != pserver->cmd_count)) {
+					state = SYSTEM_RUNNING;
 
 /* r/g/b */
 #define	RUN_BOX_ON	RGB_TO_UINT(204, 204, 0)
 #define	RUN_BOX_OFF	RGB_TO_UINT(153, 153, 0)
-						ui_set_ritem (pserver->pfb, pserver->pui,
-								pchannel->finish_r_item,
-								onoff ? RUN_BOX_ON : RUN_BOX_OFF, -1);
-
-						if ( (pchannel->watchdog_cnt > 5) &&
-							((pchannel->watchdog_cnt % 5) == 0)) {
-							protocol_msg_send (pchannel->puart, 'P', 1, "REBOOT", "-");
-							info ("%s : channel = %d\n", __func__, ch);
-						}
-					} else {
-						state = SYSTEM_FINISH;
-						pchannel->watchdog_cnt = 0;
+					ui_post_ritem (pserver, pchannel->finish_r_item,
+							pchannel->status_onoff ? RUN_BOX_ON : RUN_BOX_OFF, -1);
+
+					if ( (pchannel->watchdog_cnt > 5) &&
+						((pchannel->watchdog_cnt % 5) == 0)) {
+						protocol_msg_send (pchannel->puart, 'P', 1, "REBOOT", "-");
+						info ("%s : channel = %d\n", __func__, ch);
 					}
+				} else {
+					state = SYSTEM_FINISH;
+					pchannel->watchdog_cnt = 0;
 				}
 			}
 		}
-		if (pchannel->state == state)
-			continue;
-
-		pchannel->state = state;
-		switch (state) {
-			default :	case	SYSTEM_INIT:
-				if ((pchannel->cmd_pos != pserver->cmd_count) &&
-					(pchannel->cmd_pos))	{
-					ui_set_sitem (pserver->pfb, pserver->pui,
-							pchannel->finish_r_item, COLOR_WHITE, -1, "STOP");
-					ui_set_ritem (pserver->pfb, pserver->pui,
-							pchannel->finish_r_item, COLOR_RED, -1);
-				}
-				else
-					ui_set_ritem (pserver->pfb, pserver->pui,
-							pchannel->finish_r_item, COLOR_DIM_GRAY, -1);
+	}
+	if (pchannel->state == state)
+		return;
 
-				pchannel->cmd_pos = 0;		pchannel->is_busy = 0;
-				pchannel->is_connect = 0;	pchannel->watchdog_cnt = 0;
-			break;
-			case	SYSTEM_WAIT:
-			case	SYSTEM_BOOT:
-				ui_update_group (pserver->pfb, pserver->pui, ch ? 2 : 1);
-				ui_set_ritem (pserver->pfb, pserver->pui,
-						pchannel->finish_r_item, pserver->pui->bc.uint, -1);
-			break;
-			case	SYSTEM_RUNNING:
-				ui_set_sitem (pserver->pfb, pserver->pui,
-						pchannel->finish_r_item, COLOR_WHITE, -1, "RUNNING");
-			break;
-			case	SYSTEM_FINISH:
-			{
-				int cnt;
-				bool b_result = true;
-				for (cnt = 0; cnt < pserver->cmd_count; cnt++) {
-					if (!pserver->cmds[cnt].result[ch]) {
-						b_result = false;
-						break;
-					} 
-				}
+	pchannel->state = state;
+	switch (state) {
+		default :	case	SYSTEM_INIT:
+			if ((pchannel->cmd_pos != pserver->cmd_count) &&
+				(pchannel->cmd_pos))	{
+				ui_post_sitem (pserver,
+						pchannel->finish_r_item, COLOR_WHITE, -1, "STOP");
+				ui_post_ritem (pserver,
+						pchannel->finish_r_item, COLOR_RED, -1);
+			}
+			else
+				ui_post_ritem (pserver,
+						pchannel->finish_r_item, COLOR_DIM_GRAY, -1);
+
+			channel_cmd_reset (pserver, ch);
+			channel_baud_reset (pserver, ch);
+			protocol_v2_enable (pchannel->puart, false);
+			pchannel->is_connect = 0;	pchannel->watchdog_cnt = 0;
+		break;
+		case	SYSTEM_WAIT:
+		case	SYSTEM_BOOT:
+			ui_post_group (pserver, pchannel->ui_group);
+			ui_post_ritem (pserver,
+					pchannel->finish_r_item, pserver->pui->bc.uint, -1);
+		break;
+		case	SYSTEM_RUNNING:
+			ui_post_sitem (pserver,
+					pchannel->finish_r_item, COLOR_WHITE, -1, "RUNNING");
+		break;
+		case	SYSTEM_FINISH:
+		{
+			int cnt;
+			bool b_result = true;
+			for (cnt = 0; cnt < pserver->cmd_count; cnt++) {
+				if (!pserver->cmds[cnt].result[ch]) {
+					b_result = false;
+					break;
+				} 
+			}
 
-				/* Error print : netowrk printer */
-				if (!b_result && pserver->nlp_app)
-					nlp_error_print(pserver, ch);
+			/* Error print : netowrk printer */
+			if (!b_result && pserver->nlp_app)
+				nlp_error_print(pserver, ch);
 
-				ui_set_ritem (pserver->pfb, pserver->pui,
-						pchannel->finish_r_item, b_result ? COLOR_GREEN : COLOR_RED,-1);
-				ui_set_sitem (pserver->pfb, pserver->pui,
-						pchannel->finish_r_item, COLOR_BLACK, -1, "FINISH");
-			}
-			break;
-			case	SYSTEM_ERROR:
-				ui_set_ritem (pserver->pfb, pserver->pui,
-						pchannel->finish_r_item, COLOR_RED, -1);
-				ui_set_sitem (pserver->pfb, pserver->pui,
-						pchannel->finish_r_item, COLOR_WHITE, -1, "UART ERROR");
-			break;
+			ui_post_ritem (pserver,
+					pchannel->finish_r_item, b_result ? COLOR_GREEN : COLOR_RED,-1);
+			ui_post_sitem (pserver,
+					pchannel->finish_r_item, COLOR_BLACK, -1, "FINISH");
+			channel_rtt_dump (pserver, ch);
 		}
+		break;
+		case	SYSTEM_ERROR:
+			ui_post_ritem (pserver,
+					pchannel->finish_r_item, COLOR_RED, -1);
+			ui_post_sitem (pserver,
+					pchannel->finish_r_item, COLOR_WHITE, -1, "UART ERROR");
+		break;
 	}
 }
 
@@ -592,38 +1353,43 @@ void server_ipaddr_display (struct server_t *pserver)
 }
 #endif
 
+//------------------------------------------------------------------------------
+// alive timer (ALIVE_DISPLAY_IMTERVAL) of the main event loop
+//------------------------------------------------------------------------------
+void server_alive_timer (void *arg)
+{
+	server_alive_display ((struct server_t *)arg);
+}
+
 //------------------------------------------------------------------------------
 void server_alive_display (struct server_t *pserver)
 {
-	static struct timeval t;
 	static bool onoff = false, have_net = false;
 	static int interval_cnt = 0;
 
-	if (run_interval_check(&t, ALIVE_DISPLAY_IMTERVAL)) {
-		ui_set_ritem (pserver->pfb, pserver->pui, pserver->alive_r_item,
-					onoff ? COLOR_GREEN : pserver->pui->bc.uint, -1);
-
-		#if defined(UPTIME_DISPLAY_S_ITEM)
-			if ((interval_cnt % UPTIME_DISPLAY_INTERVAL) == 0)
-				server_uptime_display (pserver);
-		#endif
-
-		#if defined(IPADDR_DISPLAY_S_ITEM)
-			if ((interval_cnt % IPADDR_DISPLAY_INTERVAL) == 0)
-				server_ipaddr_display (pserver);
-		#endif
-
-		#if defined(NLP_DISPLAY_R_ITEM)
-			if ((interval_cnt % IPADDR_DISPLAY_INTERVAL) == 0) {
-				ui_set_sitem (pserver->pfb, pserver->pui, pserver->nlp_r_item, -1, -1,
-					pserver->nlp_ip);
-				if (!pserver->nlp_app)
-					ui_set_ritem (pserver->pfb, pserver->pui,
-							pserver->nlp_r_item, COLOR_DIM_GRAY, -1);
-			}
-		#endif
-		onoff = !onoff;	interval_cnt ++;
-	}
+	ui_set_ritem (pserver->pfb, pserver->pui, pserver->alive_r_item,
+				onoff ? COLOR_GREEN : pserver->pui->bc.uint, -1);
+
+	#if defined(UPTIME_DISPLAY_S_ITEM)
+		if ((interval_cnt % UPTIME_DISPLAY_INTERVAL) == 0)
+			server_uptime_display (pserver);
+	#endif
+
+	#if defined(IPADDR_DISPLAY_S_ITEM)
+		if ((interval_cnt % IPADDR_DISPLAY_INTERVAL) == 0)
+			server_ipaddr_display (pserver);
+	#endif
+
+	#if defined(NLP_DISPLAY_R_ITEM)
+		if ((interval_cnt % IPADDR_DISPLAY_INTERVAL) == 0) {
+			ui_set_sitem (pserver->pfb, pserver->pui, pserver->nlp_r_item, -1, -1,
+				pserver->nlp_ip);
+			if (!pserver->nlp_app)
+				ui_set_ritem (pserver->pfb, pserver->pui,
+						pserver->nlp_r_item, COLOR_DIM_GRAY, -1);
+		}
+	#endif
+	onoff = !onoff;	interval_cnt ++;
 }
 
 //------------------------------------------------------------------------------
@@ -652,196 +1418,820 @@ bool adc_pattern_check (int *values, int pin_cnt, char pattern_no, int max, int
 }
 
 //------------------------------------------------------------------------------
-void client_msg_catch (struct server_t *pserver, char ch, char ret_ack, char *msg)
+// command pipeline control
+//------------------------------------------------------------------------------
+void channel_cmd_reset (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+	int i;
+
+	for (i = 0; i < pserver->cmd_count; i++) {
+		pserver->cmds[i].state[ch] = CMD_IDLE;
+		pserver->cmds[i].retry[ch] = 0;
+	}
+	pchannel->cmd_pos = 0;
+	pchannel->cmd_inflight = 0;		pchannel->adc_inflight = false;
+	memset (pchannel->res_inflight, 0x00, sizeof(pchannel->res_inflight));
+	pchannel->rtt_cnt = 0;	pchannel->rtt_sum = 0;
+	pchannel->rtt_min = 0;	pchannel->rtt_max = 0;
+}
+
+//------------------------------------------------------------------------------
+// command round trip time : frame send to response catch (us)
+//------------------------------------------------------------------------------
+void channel_rtt_update (struct server_t *pserver, char ch, cmd_t *pcmd)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+	long rtt;
+
+	rtt = (long)(monotonic_us () - pcmd->sent_us[ch]);
+
+	if (!pchannel->rtt_cnt || (rtt < pchannel->rtt_min))
+		pchannel->rtt_min = rtt;
+	if (rtt > pchannel->rtt_max)
+		pchannel->rtt_max = rtt;
+	pchannel->rtt_sum += rtt;
+	pchannel->rtt_cnt++;
+}
+
+//------------------------------------------------------------------------------
+// compare runs with SERVER_UART_LATENCY = -1 (adapter default) and 1 ms.
+//------------------------------------------------------------------------------
+void channel_rtt_dump (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+
+	if (!pchannel->rtt_cnt)
+		return;
+
+	info ("%s : rtt avg %ld us, min %ld us, max %ld us (%d cmds)\n",
+		pchannel->dev_uart_name,
+		pchannel->rtt_sum / pchannel->rtt_cnt, pchannel->rtt_min, pchannel->rtt_max,
+		pchannel->rtt_cnt);
+	if (pchannel->latency_timer >= 0)
+		info ("%s : latency timer %d -> %d ms\n", pchannel->dev_uart_name,
+			pchannel->latency_timer,
+			(pserver->uart_latency >= 0) ? pserver->uart_latency : pchannel->latency_timer);
+}
+
+//------------------------------------------------------------------------------
+// in-flight commands go back to idle and are sent again (client busy)
+//------------------------------------------------------------------------------
+void channel_cmd_rewind (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+	int i;
+
+	for (i = pchannel->cmd_pos; i < pserver->cmd_count; i++) {
+		if (pserver->cmds[i].state[ch] == CMD_SENT)
+			pserver->cmds[i].state[ch] = CMD_IDLE;
+	}
+	pchannel->cmd_inflight = 0;		pchannel->adc_inflight = false;
+	memset (pchannel->res_inflight, 0x00, sizeof(pchannel->res_inflight));
+}
+
+//------------------------------------------------------------------------------
+// next command to send, -1 : window full or blocked by an ADC command.
+// ADC commands are measured by the server while the client holds the state,
+// so they are never overlapped with other commands.
+//------------------------------------------------------------------------------
+void channel_res_update (struct server_t *pserver, char ch, cmd_t *pcmd, int cnt)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+	int i;
+
+	for (i = 0; i < pcmd->res_count; i++) {
+		pchannel->res_inflight[pcmd->res[i]] += cnt;
+		if (pchannel->res_inflight[pcmd->res[i]] < 0)
+			pchannel->res_inflight[pcmd->res[i]] = 0;
+	}
+}
+
+//------------------------------------------------------------------------------
+// DAG plan : all dep steps are done and every resource of the step is free
+//------------------------------------------------------------------------------
+bool channel_cmd_ready (struct server_t *pserver, char ch, int pos)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+	cmd_t *pcmd = &pserver->cmds[pos];
+	int i;
+
+	for (i = 0; i < pcmd->dep_count; i++)
+		if (pserver->cmds[pcmd->dep[i]].state[ch] != CMD_DONE)
+			return false;
+
+	for (i = 0; i < pcmd->res_count; i++)
+		if (pchannel->res_inflight[pcmd->res[i]] >= pserver->res[pcmd->res[i]].limit)
+			return false;
+	return true;
+}
+
+//------------------------------------------------------------------------------
+// file order : up to cmd_window in flight, adc step alone.
+// DAG plan   : the ready step on the longest critical path first.
+//------------------------------------------------------------------------------
+int channel_cmd_next (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+	int i;
+
+	if (pserver->plan_dag) {
+		int next = -1;
+
+		for (i = pchannel->cmd_pos; i < pserver->cmd_count; i++) {
+			if (pserver->cmds[i].state[ch] != CMD_IDLE)
+				continue;
+			if (!channel_cmd_ready (pserver, ch, i))
+				continue;
+			if ((next < 0) || (pserver->cmds[i].cp_len > pserver->cmds[next].cp_len))
+				next = i;
+		}
+		return next;
+	}
+
+	if ((pchannel->cmd_inflight >= pserver->cmd_window) || pchannel->adc_inflight)
+		return -1;
+
+	for (i = pchannel->cmd_pos; i < pserver->cmd_count; i++) {
+		if (pserver->cmds[i].state[ch] != CMD_IDLE)
+			continue;
+		if (pserver->cmds[i].is_adc && pchannel->cmd_inflight)
+			return -1;
+		return i;
+	}
+	return -1;
+}
+
+//------------------------------------------------------------------------------
+// in-flight command of the response uid (matched by uid, not by cmd_pos)
+// return -1 : no in-flight command of the uid (late duplicate after a busy
+// rewind, stray frame), the response is dropped.
+//------------------------------------------------------------------------------
+int channel_cmd_find (struct server_t *pserver, char ch, int uid)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+	int i;
+
+	for (i = pchannel->cmd_pos; i < pserver->cmd_count; i++) {
+		if (pserver->cmds[i].state[ch] != CMD_SENT)
+			continue;
+		if (pserver->cmds[i].uid[ch] == uid)
+			return i;
+	}
+	err ("%s : CH %s, UID %d is not in flight, dropped\n", __func__,
+		pchannel->dev_uart_name, uid);
+	return	-1;
+}
+
+//------------------------------------------------------------------------------
+void client_msg_catch (struct server_t *pserver, char ch, protocol_msg_t *msg)
 {
 	// 보내진 uid와 지금 uid가 같은 경우 busy flag off
-	int uid, status, str_pos, len;
+	int uid = msg->uid, status = msg->status, pos;
 	char msg_str[20];
 	channel_t *pchannel = &pserver->channel[ch];
+	cmd_t *pcmd;
 
 	memset (msg_str, 0x00, sizeof(msg_str));
-	memcpy (msg_str, &msg[0], 3);
-
-	uid    = atoi (msg_str);
-	status = (msg[3] == '1') ? 1 : 0;
-	str_pos = 5;	len = sizeof(msg_str);
-	while ((msg[str_pos++] == ' ') && len--);
+	memcpy (msg_str, msg->data, sizeof(msg->data));
 
-	memset  (msg_str, 0x00, sizeof(msg_str));
-	strncpy (msg_str, &msg [str_pos-1], sizeof(msg_str));
+	if ((pos = channel_cmd_find (pserver, ch, uid)) < 0)
+		return;
+	pcmd = &pserver->cmds[pos];
+	channel_rtt_update (pserver, ch, pcmd);
 
 	/* 보내진 UI ID와 받은 UI ID가 맞는지 확인 */
-	if (uid == pserver->cmds[pchannel->cmd_pos].uid[ch]) {
-		if (pserver->cmds[pchannel->cmd_pos].is_adc) {
+	if (uid == pcmd->uid[ch]) {
+		if (pcmd->is_adc) {
 			/* ADC Header Pin Max is 40 */
 			int values[40], cnt;
-			adc_read_pin (pchannel->fd_i2c,
-				pserver->cmds[pchannel->cmd_pos].adc_name, &values[0], &cnt);
+			channel_adc_read (pserver, ch, pcmd->adc_name, &values[0], &cnt);
 
-			if (!strncmp (pserver->cmds[pchannel->cmd_pos].group,
-				"HEADER", sizeof("HEADER"))) {
+			if (!strncmp (pcmd->group, "HEADER", sizeof("HEADER"))) {
 				status = adc_pattern_check (
 					values,
 					cnt,
 					msg_str[0] - '0',
-					pserver->cmds[pchannel->cmd_pos].max,
-					pserver->cmds[pchannel->cmd_pos].min);
+					pcmd->max,
+					pcmd->min);
 
 				memset (msg_str, 0x00, sizeof(msg_str));
 				sprintf(msg_str, "%s", status ? "PASS" : "FAIL");
 			} else {
-				if (pserver->cmds[pchannel->cmd_pos].is_str) {
-					if ((!strncmp (pserver->cmds[pchannel->cmd_pos].group, "LED"  , sizeof("LED"))) ||
-						(!strncmp (pserver->cmds[pchannel->cmd_pos].group, "FAN"  , sizeof("FAN"))) ||
-						(!strncmp (pserver->cmds[pchannel->cmd_pos].group, "AUDIO", sizeof("AUDIO")))) {
+				if (pcmd->is_str) {
+					if ((!strncmp (pcmd->group, "LED"  , sizeof("LED"))) ||
+						(!strncmp (pcmd->group, "FAN"  , sizeof("FAN"))) ||
+						(!strncmp (pcmd->group, "AUDIO", sizeof("AUDIO")))) {
 						sprintf(msg_str, "%04d", values[0]);
 					}
 				}
-				if ((pserver->cmds[pchannel->cmd_pos].max < values[0]) ||
-					(pserver->cmds[pchannel->cmd_pos].min > values[0]))
+				if ((pcmd->max < values[0]) || (pcmd->min > values[0]))
 					status = 0;
 				else
 					status = 1;
 			}
 		}
 		info ("%s, %s, %s, UID %d, STATUS %d, MSG : %s\n",
-				pchannel->dev_uart_name,
-				pserver->cmds[pchannel->cmd_pos].group,
-				pserver->cmds[pchannel->cmd_pos].action,
+				pchannel->dev_uart_name, pcmd->group, pcmd->action,
 				uid, status, msg_str);
+		/* long result ('M'ore frames) */
+		if (msg->ext_len >= (int)sizeof(msg->data))
+			info ("%s, UID %d, RESULT(%d) : %.*s\n", pchannel->dev_uart_name,
+				uid, msg->ext_len, msg->ext_len, msg->ext);
 
 		/* app.cfg의 설정 참조 */
-		if (!pserver->cmds[pchannel->cmd_pos].is_info) {
-			ui_set_ritem (pserver->pfb, pserver->pui, uid,
-						status ? COLOR_GREEN : COLOR_RED, -1);
+		if (!pcmd->is_info) {
+			ui_post_ritem (pserver, uid, status ? COLOR_GREEN : COLOR_RED, -1);
 		}
 		/* app.cfg의 설정 참조 */
-		if (pserver->cmds[pchannel->cmd_pos].is_str)
-			ui_set_sitem (pserver->pfb, pserver->pui, uid, -1, -1, msg_str);
+		if (pcmd->is_str)
+			ui_post_sitem (pserver, uid, -1, -1, msg_str);
 
-		pserver->cmds[pchannel->cmd_pos].result[ch] =  status ? true : false;
+		pcmd->result[ch] =  status ? true : false;
 
-		ui_update (pserver->pfb, pserver->pui, uid);
+		ui_post_update (pserver, uid);
 	}
-	else
-		err ("%s : CH %s, UID mismatch %d, %d\n",
-			__func__, pchannel->dev_uart_name, uid, pserver->cmds[pchannel->cmd_pos].uid[ch]);
-
-	if (pchannel->cmd_pos < pserver->cmd_count-1) {
-		if (!status && (pchannel->cmd_retry < CMD_RETRY_CNT) &&
-			 pserver->cmds[pchannel->cmd_pos].is_adc) {
-			err ("ch %d : cmd %s,%s, retry = %d\n", ch,
-									pserver->cmds[pchannel->cmd_pos].group,
-									pserver->cmds[pchannel->cmd_pos].action,
-									pchannel->cmd_retry);
-			pchannel->cmd_retry++;
+
+	pchannel->cmd_inflight--;
+	if (pcmd->is_adc)
+		pchannel->adc_inflight = false;
+	channel_res_update (pserver, ch, pcmd, -1);
+
+	if (!status && (pcmd->retry[ch] < CMD_RETRY_CNT) && pcmd->is_adc) {
+		err ("ch %d : cmd %s,%s, retry = %d\n", ch,
+								pcmd->group, pcmd->action, pcmd->retry[ch]);
+		pcmd->retry[ch]++;
+		pcmd->state[ch] = CMD_IDLE;
+	}
+	else {
+		pcmd->retry[ch] = 0;	pcmd->state[ch] = CMD_DONE;
+	}
+
+	/* cmd_pos : first command not completed */
+	while ((pchannel->cmd_pos < pserver->cmd_count) &&
+		   (pserver->cmds[pchannel->cmd_pos].state[ch] == CMD_DONE))
+		pchannel->cmd_pos++;
+
+	pchannel->watchdog_cnt = 0;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+// 'R'eady frame data : capability names separated by space or ','
+//------------------------------------------------------------------------------
+int client_caps_parse (protocol_msg_t *msg)
+{
+	char data[sizeof(msg->data) +1], *ptr;
+	int caps = 0;
+
+	memset (data, 0x00, sizeof(data));
+	memcpy (data, msg->data, sizeof(msg->data));
+
+	for (ptr = strtok (data, " ,"); ptr != NULL; ptr = strtok (NULL, " ,")) {
+		if (!strncmp (ptr, "PLAN", sizeof("PLAN")))
+			caps |= CLIENT_CAP_PLAN;
+		if (!strncmp (ptr, "BAUD", sizeof("BAUD")))
+			caps |= CLIENT_CAP_BAUD;
+		if (!strncmp (ptr, "V2", sizeof("V2")))
+			caps |= CLIENT_CAP_V2;
+	}
+	return	caps;
+}
+
+//------------------------------------------------------------------------------
+// after the boot handshake the line speed is raised to SERVER_UART_BAUD.
+// the client answers the 'S' frame at the new rate, if nothing valid is
+// received in BAUD_CHECK_TIMEOUT both ends go back to 115200.
+//------------------------------------------------------------------------------
+void channel_baud_upgrade (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+	char baud_str[SEND_SIZE_group +1];
+
+	if (!(pchannel->client_caps & CLIENT_CAP_BAUD))
+		return;
+	if (pserver->uart_baud == SERVER_UART_BAUD)
+		return;
+
+	sprintf (baud_str, "%d", pserver->uart_baud);
+	protocol_msg_send (pchannel->puart, 'S', 0, baud_str, "-");
+
+	if (uart_set_baud (pchannel->puart, uart_baud_speed (pserver->uart_baud))) {
+		pchannel->baud_check = true;
+		channel_timer_start (pserver, ch, BAUD_CHECK_TIMEOUT);
+	}
+}
+
+//------------------------------------------------------------------------------
+void channel_baud_reset (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+
+	pchannel->baud_check = false;
+	if (pchannel->puart && (pchannel->puart->baud != B115200)) {
+		uart_set_baud (pchannel->puart, B115200);
+		info ("CH %s : baud rate 115200\n", pchannel->dev_uart_name);
+	}
+}
+
+//------------------------------------------------------------------------------
+struct client_msg_arg {
+	struct server_t	*pserver;
+	char			ch;
+};
+
+void client_msg_dispatch (void *arg, protocol_msg_t *msg)
+{
+	struct server_t *pserver = ((struct client_msg_arg *)arg)->pserver;
+	char ch = ((struct client_msg_arg *)arg)->ch;
+	channel_t *pchannel = &pserver->channel[ch];
+
+	/* first valid frame at the new baud rate */
+	if (pchannel->baud_check) {
+		pchannel->baud_check = false;
+		info ("CH %s : baud rate %d\n", pchannel->dev_uart_name, pserver->uart_baud);
+		if ((msg->resp == 'A') && !msg->uid) {
+			pchannel->watchdog_cnt = 0;
+			return;
 		}
-		else {
-			pchannel->cmd_retry = 0;	pchannel->cmd_pos++;
+	}
+
+	switch (msg->resp) {
+		case	'P':
+			pchannel->is_connect = false;	pchannel->client_caps = 0;
+			channel_cmd_reset (pserver, ch);
+			channel_baud_reset (pserver, ch);
+			protocol_v2_enable (pchannel->puart, false);
+		break;
+		case	'R':
+		{
+			/* client boot : ascii protocol until v2 is acknowledged */
+			bool v2;
+
+			pchannel->is_connect = true;
+			pchannel->client_caps = client_caps_parse (msg);
+			channel_cmd_reset (pserver, ch);
+			protocol_v2_enable (pchannel->puart, false);
+
+			v2 = pserver->protocol_v2 && (pchannel->client_caps & CLIENT_CAP_V2);
+			protocol_msg_send (pchannel->puart, 'A', 1, "BOOT", v2 ? "V2" : "-");
+			channel_baud_upgrade (pserver, ch);
+			if (v2)
+				protocol_v2_enable (pchannel->puart, true);
+			pchannel->state = SYSTEM_START;
 		}
+		break;
+		case	'A':	case	'O':	case	'E':
+			// msg parse & display
+			if (pchannel->is_connect && pserver->cmd_count) {
+				client_msg_catch (pserver, ch, msg);
+				/* next command is sent without waiting for the loop */
+				channel_cmd_send (pserver, ch);
+			}
+		break;
+		case	'B':
+			channel_cmd_rewind (pserver, ch);
+			/* hold time start */
+			pchannel->cmd_wait_delay = CMD_BUSY_DELAY;
+			channel_timer_start (pserver, ch, CMD_BUSY_DELAY);
+			info ("CH %s : Device Busy\n", pchannel->dev_uart_name);
+		break;
+		default :
+		break;
+	}
+	pchannel->watchdog_cnt = 0;
+}
+
+//------------------------------------------------------------------------------
+void client_msg_parser (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+	struct client_msg_arg arg;
+
+	if (!pchannel->is_available)
+		return;
+	/* all pending frames of the channel are processed at once */
+	arg.pserver = pserver;	arg.ch = ch;
+	protocol_msg_recv (pchannel->puart, client_msg_dispatch, &arg);
+
+	/* partial v2 frame, nak not answered : parsed again after the frame timeout */
+	if (protocol_v2_pending (pchannel->puart) && !tw_timer_active (&pchannel->rx_tm))
+		tw_timer_start (&pchannel->tw, &pchannel->rx_tm, PROTOCOL_V2_FRAME_TIMEOUT +1, 0);
+}
+
+//------------------------------------------------------------------------------
+// command frame of the channel protocol ('C' ascii frame is pre-encoded)
+//------------------------------------------------------------------------------
+void channel_cmd_frame_send (struct server_t *pserver, char ch, cmd_t *pcmd, char cmd)
+{
+	ptc_grp_t *puart = pserver->channel[ch].puart;
+	__u8 frame[PROTOCOL_SEND_FRAME_SIZE];
+
+	pcmd->sent_us[ch] = monotonic_us ();
+	if (protocol_v2_active (puart))
+		protocol_v2_msg_send (puart, cmd, pcmd->uid[ch], pcmd->group, pcmd->action);
+	else if (cmd == 'C')
+		protocol_frame_send (puart, pcmd->frame[ch]);
+	else {
+		protocol_pack (frame, cmd, pcmd->uid[ch], pcmd->group, pcmd->action);
+		protocol_frame_send (puart, frame);
+	}
+}
+
+//------------------------------------------------------------------------------
+// plan download : consecutive non-ADC commands from cmd_pos are loaded to the
+// client with 'L' frames and started with one 'G' frame. the client runs them
+// and streams the results, which client_msg_catch matches by uid.
+// ADC commands end a plan segment because the server measures them while the
+// client holds the state, they are sent one by one as before.
+// a segment is limited to the frames tx_q can take with the 'G' frame (and to
+// the v2 tx ring for nak), the rest is sent after the segment is completed.
+// return : number of commands loaded, -1 : no room in tx_q (next send tick)
+//------------------------------------------------------------------------------
+int channel_plan_send (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+	ptc_grp_t *puart = pchannel->puart;
+	int i, cnt = 0, max;
+
+	if (pchannel->cmd_inflight)
+		return	0;
+
+	max = queue_space (&puart->tx_q) /
+		(protocol_v2_active (puart) ? PROTOCOL_V2_FRAME_MAX : PROTOCOL_SEND_FRAME_SIZE) -1;
+	if (protocol_v2_active (puart) && (max > PROTOCOL_V2_TX_RING -1))
+		max = PROTOCOL_V2_TX_RING -1;
+	if (max < 1)
+		return	-1;
+
+	for (i = pchannel->cmd_pos; (i < pserver->cmd_count) && (cnt < max); i++) {
+		cmd_t *pcmd = &pserver->cmds[i];
+
+		if (pcmd->state[ch] == CMD_DONE)
+			continue;
+		if (pcmd->is_adc)
+			break;
+
+		channel_cmd_frame_send (pserver, ch, pcmd, 'L');
+		pcmd->state[ch] = CMD_SENT;
+		cnt++;
+	}
+	if (cnt) {
+		protocol_msg_send (puart, 'G', cnt, "PLAN", "-");
+		pchannel->cmd_inflight = cnt;
+		dbg ("CH %s : plan %d steps loaded\n", pchannel->dev_uart_name, cnt);
+	}
+	return	cnt;
+}
+
+//------------------------------------------------------------------------------
+// send commands of the channel up to the window.
+// called from the loop and right after a response has been processed,
+// so the next command does not wait for a send tick.
+//------------------------------------------------------------------------------
+void channel_cmd_send (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+	int pos;
+
+	/* client busy : per-channel hold time (cleared by channel_cmd_timeout) */
+	if (pchannel->cmd_wait_delay)
+		return;
+	if (!pchannel->power_status || !pchannel->is_connect || pchannel->baud_check)
+		return;
+	if (!pserver->cmd_count || (pchannel->state != SYSTEM_RUNNING))
+		return;
+
+	/* plan download runs the steps in file order on the client */
+	if (pserver->plan_download && !pserver->plan_dag &&
+		(pchannel->client_caps & CLIENT_CAP_PLAN)) {
+		if (channel_plan_send (pserver, ch))
+			return;
+	}
+
+	/* keep up to cmd_window commands in flight */
+	while ((pos = channel_cmd_next (pserver, ch)) >= 0) {
+		channel_cmd_frame_send (pserver, ch, &pserver->cmds[pos], 'C');
+		pserver->cmds[pos].state[ch] = CMD_SENT;
+		pchannel->cmd_inflight++;
+		if (pserver->cmds[pos].is_adc)
+			pchannel->adc_inflight = true;
+		channel_res_update (pserver, ch, &pserver->cmds[pos], 1);
+	}
+}
+
+//------------------------------------------------------------------------------
+void cmd_sned_control (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+
+	if (!pchannel->is_available)
+		return;
+	if (pchannel->power_status) {
+		channel_cmd_send (pserver, ch);
+		pchannel->watchdog_cnt = 0;
+	}
+}
+
+//------------------------------------------------------------------------------
+// cmd timer (one-shot) : busy hold time, baud rate check timeout
+//------------------------------------------------------------------------------
+void channel_timer_start (struct server_t *pserver, char ch, int delay_ms)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+
+	tw_timer_start (&pchannel->tw, &pchannel->cmd_tm, delay_ms, 0);
+}
+
+//------------------------------------------------------------------------------
+// channel timer wheel callbacks (arg : channel_t, worker thread)
+//------------------------------------------------------------------------------
+void channel_cmd_timeout (void *arg)
+{
+	channel_t *pchannel = (channel_t *)arg;
+	struct server_t *pserver = pchannel->pserver;
+	char ch = pchannel->ch;
+
+	if (pchannel->baud_check) {
+		err ("CH %s : no response at baud rate %d\n",
+					pchannel->dev_uart_name, pserver->uart_baud);
+		channel_baud_reset (pserver, ch);
+	}
+	pchannel->cmd_wait_delay = 0;
+}
+
+//------------------------------------------------------------------------------
+void channel_power_timer (void *arg)
+{
+	channel_t *pchannel = (channel_t *)arg;
+
+	power_pins_check (pchannel->pserver, pchannel->ch);
+}
+
+//------------------------------------------------------------------------------
+void channel_watchdog_timer (void *arg)
+{
+	channel_t *pchannel = (channel_t *)arg;
+
+	system_watchdog (pchannel->pserver, pchannel->ch);
+}
+
+//------------------------------------------------------------------------------
+void channel_status_timer (void *arg)
+{
+	channel_t *pchannel = (channel_t *)arg;
+
+	server_status_display (pchannel->pserver, pchannel->ch);
+}
+
+//------------------------------------------------------------------------------
+void channel_rx_timer (void *arg)
+{
+	channel_t *pchannel = (channel_t *)arg;
+
+	client_msg_parser (pchannel->pserver, pchannel->ch);
+}
+
+//------------------------------------------------------------------------------
+// tcp: / pty: link reopen, retried until the peer is back
+//------------------------------------------------------------------------------
+void channel_link_timer (void *arg)
+{
+	channel_t *pchannel = (channel_t *)arg;
+	struct server_t *pserver = pchannel->pserver;
+	char ch = pchannel->ch;
+
+	if (pchannel->is_available)
+		return;
+
+	if (channel_attach (pserver, ch)) {
+		info ("%s : %s link open\n", pchannel->name, pchannel->dev_uart_name);
+		channel_rx_watch (pserver, ch);
 	}
 	else
-		pchannel->cmd_pos = pserver->cmd_count;
+		tw_timer_start (&pchannel->tw, &pchannel->link_tm, LINK_RETRY_INTERVAL, 0);
+	channel_status_display (pserver, ch);
+}
 
-	pchannel->watchdog_cnt = 0;
+//------------------------------------------------------------------------------
+// link lost (hangup, read error, signalled by the io reactor) : the link is
+// closed, a tcp: / pty: link is opened again, a usb uart waits for the uevent.
+//------------------------------------------------------------------------------
+void channel_link_check (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+
+	if (!ptc_link_lost (pchannel->puart))
+		return;
+
+	err ("%s : %s link lost\n", pchannel->name, pchannel->dev_uart_name);
+	channel_detach (pserver, ch);
+	channel_rx_watch (pserver, ch);
+	channel_status_display (pserver, ch);
+
+	if (pchannel->link[0])
+		tw_timer_start (&pchannel->tw, &pchannel->link_tm, LINK_RETRY_INTERVAL, 0);
 }
 
 //------------------------------------------------------------------------------
-void client_msg_parser (struct server_t *pserver)
+// rx_q eventfd of the current link in the worker epoll set.
+// a closed link fd is removed from the set by the kernel.
+//------------------------------------------------------------------------------
+void channel_rx_watch (struct server_t *pserver, char ch)
 {
-	char msg[CMD_CHAR_MAX], ch, cmd;
-	channel_t *pchannel;
+	channel_t *pchannel = &pserver->channel[ch];
 
-	for (ch = 0; ch < CH_END; ch++) {
-		pchannel = &pserver->channel[ch];
-		if (!pchannel->is_available)
+	if (pchannel->rx_fd >= 0)
+		epoll_ctl (pchannel->epfd, EPOLL_CTL_DEL, pchannel->rx_fd, NULL);
+	pchannel->rx_fd = -1;
+
+	if ((pchannel->puart != NULL) &&
+		epoll_fd_add (pchannel->epfd, pchannel->puart->rx_q.evt_fd))
+		pchannel->rx_fd = pchannel->puart->rx_q.evt_fd;
+}
+
+//------------------------------------------------------------------------------
+void channel_wakeup (struct server_t *pserver, char ch)
+{
+	if (pserver->channel[ch].wake_fd >= 0)
+		eventfd_write (pserver->channel[ch].wake_fd, 1);
+}
+
+//------------------------------------------------------------------------------
+bool channel_event_init (struct server_t *pserver, char ch)
+{
+	channel_t *pchannel = &pserver->channel[ch];
+
+	pchannel->rx_fd        = -1;
+	pchannel->epfd         = epoll_create1 (EPOLL_CLOEXEC);
+	pchannel->wake_fd      = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+	pchannel->tick_tfd     = timer_fd_open (0, false);
+
+	if ((pchannel->epfd < 0) || (pchannel->wake_fd < 0) || (pchannel->tick_tfd < 0))
+		return false;
+
+	if (!epoll_fd_add (pchannel->epfd, pchannel->wake_fd)	||
+		!epoll_fd_add (pchannel->epfd, pchannel->tick_tfd))
+		return false;
+
+	tw_init (&pchannel->tw);
+	tw_timer_init (&pchannel->power_tm,    channel_power_timer,    pchannel);
+	tw_timer_init (&pchannel->watchdog_tm, channel_watchdog_timer, pchannel);
+	tw_timer_init (&pchannel->status_tm,   channel_status_timer,   pchannel);
+	tw_timer_init (&pchannel->cmd_tm,      channel_cmd_timeout,    pchannel);
+	tw_timer_init (&pchannel->rx_tm,       channel_rx_timer,       pchannel);
+	tw_timer_init (&pchannel->link_tm,     channel_link_timer,     pchannel);
+
+	tw_timer_start (&pchannel->tw, &pchannel->power_tm,
+					POWER_CHECK_INTERVAL,    POWER_CHECK_INTERVAL);
+	tw_timer_start (&pchannel->tw, &pchannel->watchdog_tm,
+					WATCHDOG_CHECK_INTERVAL, WATCHDOG_CHECK_INTERVAL);
+	tw_timer_start (&pchannel->tw, &pchannel->status_tm,
+					STATUS_CHECK_INTERVAL,   STATUS_CHECK_INTERVAL);
+	/* tcp: / pty: link not opened at start */
+	if (pchannel->link[0] && !pchannel->is_available)
+		tw_timer_start (&pchannel->tw, &pchannel->link_tm, LINK_RETRY_INTERVAL, 0);
+	tw_fd_arm (&pchannel->tw, pchannel->tick_tfd);
+
+	channel_rx_watch (pserver, ch);
+	return true;
+}
+
+//------------------------------------------------------------------------------
+// channel worker : a slow channel (adc read, client response) does not hold
+// the cycle of the other channels. ui / printer requests are queued.
+// the worker sleeps until a wheel timer is due, a frame is received or a wakeup.
+//------------------------------------------------------------------------------
+#define	WORKER_EVENT_MAX	8
+
+void *channel_worker (void *arg)
+{
+	channel_t *pchannel = (channel_t *)arg;
+	struct server_t *pserver = pchannel->pserver;
+	struct epoll_event evs[WORKER_EVENT_MAX];
+	char ch = pchannel->ch;
+	int i, ev_cnt;
+
+	while (pserver->running) {
+		bool rx = false;
+
+		if ((ev_cnt = epoll_wait (pchannel->epfd, evs, WORKER_EVENT_MAX, -1)) < 0)
 			continue;
-		memset (msg, 0x00, sizeof(msg));
-		if (protocol_msg_check (pchannel->puart, &cmd, msg)) {
-			switch (cmd) {
-				case	'P':
-					pchannel->is_connect = false;	pchannel->is_busy = false;
-				break;
-				case	'R':
-					pchannel->is_connect = true;	pchannel->is_busy = false;
-					pchannel->cmd_pos = 0;
-					protocol_msg_send (pchannel->puart, 'A', 1, "BOOT", "-");
-					pchannel->state = SYSTEM_START;
-				break;
-				case	'A':	case	'O':	case	'E':
-					// msg parse & display
-					if (pchannel->is_connect && pserver->cmd_count) {
-						client_msg_catch (pserver, ch, cmd, msg);
-						pchannel->is_busy = false;
-					}
-				break;
-				case	'B':
-					pchannel->is_busy = false;
-					pchannel->cmd_wait_delay = (1000 / CMD_SEND_INTERVAL);
-					info ("CH %s : Device Busy\n", pchannel->dev_uart_name);
-				break;
-				default :
-				break;
+
+		pthread_mutex_lock (&pchannel->lock);
+		for (i = 0; i < ev_cnt; i++) {
+			int fd = evs[i].data.fd;
+
+			if      (fd == pchannel->tick_tfd)
+				timer_fd_expired (fd);
+			else if (fd == pchannel->wake_fd) {
+				/* link attached / detached */
+				event_fd_clear (fd);
+				channel_rx_watch (pserver, ch);
+				rx = true;
 			}
-			memset (msg, 0x00, sizeof(msg));
-			pchannel->watchdog_cnt = 0;
+			else if (fd == pchannel->rx_fd) {
+				/* cleared before the read, no frame is left behind */
+				event_fd_clear (fd);
+				rx = true;
+			}
+		}
+		/* power check, watchdog, status display, cmd hold timeout */
+		tw_run (&pchannel->tw);
+		cmd_sned_control (pserver, ch);
+		if (rx) {
+			client_msg_parser (pserver, ch);
+			channel_link_check (pserver, ch);
 		}
+		tw_fd_arm (&pchannel->tw, pchannel->tick_tfd);
+		pthread_mutex_unlock (&pchannel->lock);
 	}
+	return NULL;
 }
 
 //------------------------------------------------------------------------------
-void cmd_sned_control (struct server_t *pserver)
+void app_worker_start (struct server_t *pserver)
 {
-	static struct timeval t;
-	char ch;
-	channel_t *pchannel;
+	int ch;
 
-	if (run_interval_check(&t, CMD_SEND_INTERVAL)) {
-		for (ch = 0; ch < CH_END; ch++) {
-			pchannel = &pserver->channel[ch];
-			if (!pserver->channel[ch].is_available)
-				continue;
-			if (pchannel->cmd_wait_delay) {
-				pchannel->cmd_wait_delay--;
-				continue;
-			}
-			if (pchannel->power_status) {
-				if (!pchannel->is_connect || pchannel->is_busy)
-					continue;
-				if (!pserver->cmd_count)
-					continue;
-				if ((pserver->cmd_count != pchannel->cmd_pos) &&
-					(pchannel->state == SYSTEM_RUNNING))	{
-					protocol_msg_send (pchannel->puart, 'C',
-									pserver->cmds[pchannel->cmd_pos].uid[ch],
-									pserver->cmds[pchannel->cmd_pos].group,
-									pserver->cmds[pchannel->cmd_pos].action);
-					pchannel->is_busy = true;
-				}
-				pchannel->watchdog_cnt = 0;
-			}
+	pserver->running = true;
+	if (pthread_create (&pserver->nlp_thread, NULL, nlp_print_thread, pserver)) {
+		err ("SYSTEM Initialize fail(PRINTER THREAD)\n");
+		exit(0);
+	}
+	for (ch = 0; ch < pserver->ch_count; ch++) {
+		channel_t *pchannel = &pserver->channel[ch];
+
+		pchannel->pserver = pserver;	pchannel->ch = ch;
+		pthread_mutex_init (&pchannel->lock, NULL);
+		if (!channel_event_init (pserver, ch)) {
+			err ("SYSTEM Initialize fail(%s EVENT)\n", pchannel->name);
+			exit(0);
+		}
+		if (pthread_create (&pchannel->thread, NULL, channel_worker, pchannel)) {
+			err ("SYSTEM Initialize fail(%s WORKER)\n", pchannel->name);
+			exit(0);
 		}
 	}
 }
 
 //------------------------------------------------------------------------------
-int main(int argc, char **argv)
+// main thread : alive display, usb uart hotplug, ui requests of the workers,
+// stats dump (SIGUSR1). nothing is polled, epoll_wait sleeps until an event.
+//------------------------------------------------------------------------------
+#define	MAIN_EVENT_MAX		4
+
+void app_event_loop (struct server_t *pserver)
 {
-	struct server_t	server;
+	struct epoll_event evs[MAIN_EVENT_MAX];
+	int i, ev_cnt;
+
+	pserver->epfd     = epoll_create1 (EPOLL_CLOEXEC);
+	pserver->tick_tfd = timer_fd_open (0, false);
+	if ((pserver->epfd < 0) || (pserver->tick_tfd < 0) ||
+		!epoll_fd_add (pserver->epfd, pserver->tick_tfd) ||
+		!epoll_fd_add (pserver->epfd, pserver->ui_q.evt_fd)) {
+		err ("SYSTEM Initialize fail(EVENT LOOP)\n");
+		exit(0);
+	}
+	if ((pserver->uevent_fd >= 0) && !epoll_fd_add (pserver->epfd, pserver->uevent_fd))
+		err ("uevent epoll add error! (%s)\n", strerror(errno));
 
-	app_init (&server);
+	tw_init (&pserver->tw);
+	tw_timer_init  (&pserver->alive_tm, server_alive_timer, pserver);
+	tw_timer_start (&pserver->tw, &pserver->alive_tm,
+					ALIVE_DISPLAY_IMTERVAL, ALIVE_DISPLAY_IMTERVAL);
 
+	server_alive_display (pserver);
 	while (true) {
-		server_alive_display(&server);
+		tw_fd_arm (&pserver->tw, pserver->tick_tfd);
+		ev_cnt = epoll_wait (pserver->epfd, evs, MAIN_EVENT_MAX, -1);
+
+		for (i = 0; i < ev_cnt; i++) {
+			int fd = evs[i].data.fd;
+
+			if      (fd == pserver->tick_tfd)
+				timer_fd_expired (fd);
+			else if (fd == pserver->uevent_fd)
+				uart_hotplug_check (pserver);
+			else if (fd == pserver->ui_q.evt_fd)
+				event_fd_clear (fd);
+		}
+		tw_run (&pserver->tw);
+		/* SIGUSR1 handler wakes up the loop through the ui queue eventfd */
+		server_stats_dump (pserver);
+		ui_queue_flush    (pserver);
+	}
+}
 
-		power_pins_check	(&server);
-		cmd_sned_control    (&server);
-		client_msg_parser   (&server);
-		system_watchdog		(&server);
-		server_status_display (&server);
+//------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	struct server_t	server;
 
-		usleep(APP_LOOP_DELAY);
-	}
+	app_init (&server);
+	app_worker_start (&server);
+	app_event_loop (&server);
 
 	app_exit(&server);
 	return 0;
@@ -19,7 +19,7 @@
 #define	SERVER_FB_DEVICE		"/dev/fb0"
 #define	SERVER_UI_CONFIG		"ui.cfg"
 
-#define	FIND_UART_NODE_BASE		"/sys/devices"
+#define	FIND_UART_NODE_BASE		"/sys/class/tty"
 
 #define	SERVER_UART_L_DEVICE	"/dev/ttyUSB0"
 #define	SERVER_UART_L_USB_PORT	"usb/usb1/1-1/1-1.4/1-1.4:1.0"
@@ -32,31 +32,52 @@
 #define	WATCHDOG_CHECK_INTERVAL	1000	/* 1 sec */
 #define	WATCHDOG_RESET_COUNT	60	    // 60 sec
 
+#define	SERVER_UART_BAUD		115200	/* boot handshake baud rate */
+#define	BAUD_CHECK_TIMEOUT		500		/* 500 ms, no frame at new baud : fallback */
+#define	SERVER_UART_LATENCY		1		/* 1 ms, usb-serial latency timer */
+#define	UEVENT_BUF_SIZE			4096
+
 #define	CMD_CHAR_MAX	        128
-#define	CMD_SEND_INTERVAL	    20      // 20 ms
+#define	CMD_BUSY_DELAY		    1000    // 1 sec, client busy hold time
 #define	CMD_COUNT_MAX	        256
+#define	CMD_WINDOW_DEFAULT	    1       // commands in flight per channel
+#define	CMD_WINDOW_MAX	        16
 #define	POWER_PINS_MAX	        16
 
+/* DAG test plan : SERVER_CMD dep:/res: annotation, SERVER_RESOURCE */
+#define	CMD_DEP_MAX				4
+#define	CMD_RES_MAX				2
+#define	CMD_ANNOT_SIZE			64
+#define	RESOURCE_MAX			8
+#define	RESOURCE_ADC			"ADC"
+#define	RESOURCE_CLIENT			"CLIENT"
+
 #define	ALIVE_DISPLAY_R_ITEM	0
 #define	ALIVE_DISPLAY_IMTERVAL	1000	/* 1000 ms */
 
 #define	FINISH_DISPLAY_R_ITEM_L	162
 #define	FINISH_DISPLAY_R_ITEM_R	166
-#define	APP_LOOP_DELAY			500		/* 500 us */
+/* worker threads -> main thread(ui) / printer thread */
+#define	UI_QUEUE_SIZE			256
+#define	NLP_QUEUE_SIZE			16
 
 #define	STATUS_L_UART_R_ITEM	42
 #define	STATUS_R_UART_R_ITEM	46
 
 #define	POWER_CHECK_INTERVAL	500		/* 500ms */
 #define	STATUS_CHECK_INTERVAL	500
+/* tcp: / pty: link reopen after the link is lost */
+#define	LINK_RETRY_INTERVAL		1000
+
+/* simulator memory framebuffer size */
+#define	SIM_FB_WIDTH			1920
+#define	SIM_FB_HEIGHT			1080
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-enum eCHANNEL {
-	CH_L = 0,
-	CH_R,
-	CH_END
-};
+/* SERVER_CHANNEL lines of app.cfg (default : left / right) */
+#define	CHANNEL_MAX				8
+#define	CHANNEL_DEFAULT_COUNT	2
 
 //------------------------------------------------------------------------------
 enum SYSTEM_STATE {
@@ -77,11 +98,19 @@ enum SYSTEM_STATE {
 
 //------------------------------------------------------------------------------
 typedef struct channel__t {
+	/* channel name (log, printer channel) */
+	char		name[16];
+	/* UI : channel group id, status display ritem */
+	int			ui_group;
+	int			status_r_item;
+
 	/* UART Control struct */
 	ptc_grp_t	*puart;
 
-	/* command를 보내고 데이터를 기다리는 상태 표시 */
-	bool	is_busy;
+	/* command를 보내고 데이터를 기다리는 command 수 (max cmd_window) */
+	int		cmd_inflight;
+	/* ADC command는 다른 command와 동시에 진행하지 않음 */
+	bool	adc_inflight;
 	/* ttyUSB node가 있어 UART open이 가능한 상태표시 */
 	bool	is_available;
 	/* POWER_PIN으로 정의 되어진 모든 PIN이 정상인지 표시 */
@@ -90,6 +119,8 @@ typedef struct channel__t {
 	/* Client 보드와 통신하기 위한 USB uart node 이름 */
 	char	dev_uart_name[128];
 	char	usb_port[128];
+	/* link address (SERVER_CHANNEL) : tcp:host:port, pty:link */
+	char	link[128];
 
 	/* ADC Board를 control하기 위한 device node 및 fd */
 	int		fd_i2c;
@@ -98,19 +129,29 @@ typedef struct channel__t {
 	/* Client와 Server간의 BOOT cmd의 명령어 처리 상태 표시 */
 	bool	is_connect;
 
-	/* 진행중인 테스트 command위치 */
+	/* capabilities of the client ('R'eady frame data, CLIENT_CAP_xxx) */
+	int		client_caps;
+
+	/* baud rate changed, waiting for the first frame at the new rate */
+	bool	baud_check;
+
+	/* 완료되지 않은 첫번째 테스트 command위치 */
 	int		cmd_pos;
+	/* DAG plan : steps in flight of each resource (server_t res) */
+	int		res_inflight[RESOURCE_MAX];
 
 #define	CMD_RETRY_CNT	3
-	int		cmd_retry;
 
-	/* command send control time */
-	struct timeval t;
+	/* usb-serial latency timer before the tuning (ms, -1 : none) */
+	int		latency_timer;
+	/* command round trip time (us) */
+	int		rtt_cnt;
+	long	rtt_sum, rtt_min, rtt_max;
 
 	/* watchdog count */
 	int				watchdog_cnt;
 
-	/* Busy status의 경우 일정시간 cmd delay */
+	/* Busy status의 경우 일정시간 cmd delay (ms) */
 	int				cmd_wait_delay;
 
 	/* Test result display */
@@ -118,6 +159,24 @@ typedef struct channel__t {
 
     /* channel run state */
     char            state;
+
+	/* worker thread : power check, cmd send, msg parse, watchdog, status */
+	pthread_t		thread;
+	/* worker cycle <-> main thread (hotplug attach/detach, stats dump) */
+	pthread_mutex_t	lock;
+	struct server_t	*pserver;
+	char			ch;
+
+	/* worker epoll : wheel timerfd, rx_q eventfd */
+	int				epfd, tick_tfd;
+	/* periodic power / watchdog / status, one-shot cmd hold (busy, baud),
+	   one-shot rx parse of a partial v2 frame, tcp: / pty: link reopen */
+	timer_wheel_t	tw;
+	tw_timer_t		power_tm, watchdog_tm, status_tm, cmd_tm, rx_tm, link_tm;
+	/* rx eventfd in the epoll set, wake_fd : attach/detach, exit */
+	int				rx_fd, wake_fd;
+	int				status_cnt;
+	bool			status_onoff;
 }	channel_t;
 
 //------------------------------------------------------------------------------
@@ -127,17 +186,70 @@ typedef struct power_pins__t {
 }	power_pins_t;
 
 //------------------------------------------------------------------------------
+/* steps of the DAG plan in flight at the same time (per channel) */
+typedef struct resource__t {
+	char	name[16];
+	int		limit;
+}	resource_t;
+
+//------------------------------------------------------------------------------
+/* client capability bits */
+#define	CLIENT_CAP_PLAN			0x01
+#define	CLIENT_CAP_BAUD			0x02
+#define	CLIENT_CAP_V2			0x04
+
+//------------------------------------------------------------------------------
+enum CMD_STATE {
+	CMD_IDLE = 0,
+	/* sent, waiting for the response */
+	CMD_SENT,
+	CMD_DONE
+};
+
 typedef struct cmd__t {
 	bool		is_info, is_str, is_adc;
-	int			uid[2];
+	int			uid[CHANNEL_MAX];
 	char		group[10];
 	char		action[10];
 	char		adc_name[16];
 	int			max, min;
 	/* command result */
-	bool		result[2];
+	bool		result[CHANNEL_MAX];
+	/* pipeline state(enum CMD_STATE), retry count of each channel */
+	char		state[CHANNEL_MAX];
+	char		retry[CHANNEL_MAX];
+	/* pre-encoded 'C' frame of each channel (encoded at load time) */
+	__u8		frame[CHANNEL_MAX][PROTOCOL_SEND_FRAME_SIZE];
+	/* frame send time of each channel (round trip time) */
+	unsigned long long	sent_us[CHANNEL_MAX];
+	/* DAG plan : steps to be done before (cmds index), resources (res index) */
+	int			dep[CMD_DEP_MAX], dep_count;
+	int			res[CMD_RES_MAX], res_count;
+	/* critical path : steps to the end of the plan (issue priority) */
+	int			cp_len;
 }	cmd_t;
 
+//------------------------------------------------------------------------------
+/* ui request of the worker threads, drawn by the main thread */
+enum UI_MSG_TYPE {
+	UI_MSG_RITEM = 0,
+	UI_MSG_SITEM,
+	UI_MSG_UPDATE,
+	UI_MSG_GROUP
+};
+
+typedef struct ui_msg__t {
+	char		type;
+	int			id, fc, bc, lc;
+	char		str[32];
+}	ui_msg_t;
+
+/* error page of the printer thread */
+typedef struct nlp_msg__t {
+	char		ch_name[16];
+	char		str[64];
+}	nlp_msg_t;
+
 //------------------------------------------------------------------------------
 struct server_t {
 
@@ -155,13 +267,49 @@ struct server_t {
 
 	fb_info_t	*pfb;
 	ui_grp_t	*pui;
-	channel_t	channel[2];
+	/* channel_load : SERVER_CHANNEL count (malloc) */
+	int			ch_count;
+	channel_t	*channel;
 
 	int				power_pin_count;
 	power_pins_t	power_pins[POWER_PINS_MAX];
 
 	int				cmd_count;
 	cmd_t 			cmds[CMD_COUNT_MAX];
+	/* max commands in flight per channel */
+	int				cmd_window;
+	/* DAG plan (dep:/res: annotation or SERVER_RESOURCE), false : file order */
+	bool			plan_dag;
+	int				res_count;
+	resource_t		res[RESOURCE_MAX];
+	/* download the test plan to clients that support it */
+	bool			plan_download;
+	/* uart baud rate after the boot handshake (bps) */
+	int				uart_baud;
+	/* usb-serial latency timer (ms, -1 : driver default) */
+	int				uart_latency;
+	/* binary protocol v2 with clients that support it */
+	bool			protocol_v2;
+
+	/* channel worker threads run flag */
+	bool			running;
+	/* main thread epoll : wheel timerfd, ui queue eventfd, uevent socket */
+	int				epfd, tick_tfd;
+	timer_wheel_t	tw;
+	tw_timer_t		alive_tm;
+	/* ui (main thread) & network printer (nlp_thread) request queue */
+	msg_queue_t		ui_q;
+	msg_queue_t		nlp_q;
+	pthread_t		nlp_thread;
+
+	/* kernel uevent socket (usb uart hotplug), -1 : disabled */
+	int				uevent_fd;
+
+	/* pty client simulator (SERVER_SIMULATOR) */
+	struct sim__t	*psim;
+	bool			sim_enable;
+	/* latency(ms), drop, busy, garbage, error (per 1000 responses) */
+	int				sim_cfg[5];
 };
 
 //------------------------------------------------------------------------------
@@ -299,24 +447,83 @@ const __u16	Patterns[4][40] = {
 #endif
 
 //------------------------------------------------------------------------------
+void	nlp_error_print_page	(struct server_t *pserver, const char *ch_name,
+									const char *pstr);
+void	nlp_error_page_post		(struct server_t *pserver, char ch, const char *pstr);
 void 	nlp_error_print			(struct server_t *pserver, char ch);
+void	*nlp_print_thread		(void *arg);
 
 //------------------------------------------------------------------------------
 void	find_uart_dev 			(struct server_t *pserver, int channel);
+void	find_link_dev 			(struct server_t *pserver, int channel);
+void	app_sim_init 			(struct server_t *pserver);
+void	app_sim_start 			(struct server_t *pserver);
+bool	channel_adc_read 		(struct server_t *pserver, char ch, const char *name,
+									int *values, int *cnt);
+bool	channel_parse 			(channel_t *pchannel, char *cmd_line);
+void	channel_load 			(struct server_t *pserver);
+int		resource_find 			(struct server_t *pserver, const char *name);
+void	resource_load 			(struct server_t *pserver);
+int		cmd_name_find 			(struct server_t *pserver, const char *name);
+bool	cmd_dag_build 			(struct server_t *pserver);
 void	server_cmd_load 		(struct server_t *pserver);
 void	power_pin_load 			(struct server_t *pserver);
 void	app_cfg_load 			(struct server_t *pserver);
 void	app_protocol_install 	(struct server_t *pserver);
+bool	channel_attach 			(struct server_t *pserver, char ch);
+void	channel_detach 			(struct server_t *pserver, char ch);
+void	channel_status_display 	(struct server_t *pserver, char ch);
+void	app_hotplug_init 		(struct server_t *pserver);
+void	uart_hotplug_check 		(struct server_t *pserver);
 int		app_init 				(struct server_t *pserver);
 void	app_exit 				(struct server_t *pserver);
-void	power_pins_check 		(struct server_t *pserver);
-void	system_watchdog 		(struct server_t *pserver);
-void	server_status_display 	(struct server_t *pserver);
+void	app_stats_signal 		(int signo);
+void	server_stats_dump 		(struct server_t *pserver);
+void	ui_post_ritem 			(struct server_t *pserver, int id, int bc, int lc);
+void	ui_post_sitem 			(struct server_t *pserver, int id, int fc, int bc,
+									const char *str);
+void	ui_post_update 			(struct server_t *pserver, int id);
+void	ui_post_group 			(struct server_t *pserver, int gid);
+void	ui_queue_flush 			(struct server_t *pserver);
+void	ui_channel_lock 		(struct server_t *pserver, char ch);
+void	power_pins_check 		(struct server_t *pserver, char ch);
+void	system_watchdog 		(struct server_t *pserver, char ch);
+void	server_status_display 	(struct server_t *pserver, char ch);
 void	server_alive_display 	(struct server_t *pserver);
 bool	adc_pattern_check 		(int *values, int pin_cnt, char pattern_no, int max, int min);
-void	client_msg_catch 		(struct server_t *pserver, char ch, char ret_ack, char *msg);
-void	client_msg_parser 		(struct server_t *pserver);
-void	cmd_sned_control 		(struct server_t *pserver);
+void	channel_cmd_reset 		(struct server_t *pserver, char ch);
+void	channel_rtt_update 		(struct server_t *pserver, char ch, cmd_t *pcmd);
+void	channel_rtt_dump 		(struct server_t *pserver, char ch);
+void	channel_cmd_rewind 		(struct server_t *pserver, char ch);
+void	channel_res_update 		(struct server_t *pserver, char ch, cmd_t *pcmd, int cnt);
+bool	channel_cmd_ready 		(struct server_t *pserver, char ch, int pos);
+int		channel_cmd_next 		(struct server_t *pserver, char ch);
+int		channel_cmd_find 		(struct server_t *pserver, char ch, int uid);
+void	client_msg_catch 		(struct server_t *pserver, char ch, protocol_msg_t *msg);
+void	channel_cmd_send 		(struct server_t *pserver, char ch);
+int		channel_plan_send 		(struct server_t *pserver, char ch);
+void	channel_cmd_frame_send 	(struct server_t *pserver, char ch, cmd_t *pcmd, char cmd);
+int		client_caps_parse 		(protocol_msg_t *msg);
+void	channel_baud_upgrade 	(struct server_t *pserver, char ch);
+void	channel_baud_reset 		(struct server_t *pserver, char ch);
+void	client_msg_dispatch 	(void *arg, protocol_msg_t *msg);
+void	client_msg_parser 		(struct server_t *pserver, char ch);
+void	cmd_sned_control 		(struct server_t *pserver, char ch);
+void	channel_timer_start 	(struct server_t *pserver, char ch, int delay_ms);
+void	channel_cmd_timeout 	(void *arg);
+void	channel_power_timer 	(void *arg);
+void	channel_watchdog_timer 	(void *arg);
+void	channel_status_timer 	(void *arg);
+void	channel_rx_timer 		(void *arg);
+void	channel_link_timer 		(void *arg);
+void	channel_link_check 		(struct server_t *pserver, char ch);
+void	server_alive_timer 		(void *arg);
+void	channel_rx_watch 		(struct server_t *pserver, char ch);
+void	channel_wakeup 			(struct server_t *pserver, char ch);
+bool	channel_event_init 		(struct server_t *pserver, char ch);
+void	*channel_worker 		(void *arg);
+void	app_worker_start 		(struct server_t *pserver);
+void	app_event_loop 			(struct server_t *pserver);
 int		main					(int argc, char **argv);
 
 //------------------------------------------------------------------------------